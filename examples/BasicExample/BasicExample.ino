@@ -50,6 +50,12 @@ float temperature;
 #define POTENTIOMETERPIN 2
 int pot;
 
+#if defined(ANALOG_CHANNELS_SUPPORT)
+// Audio taper potentiometer (10% at half turn) linearised to 0 - 1023:
+// knob position [1/ANALOG_SCALE] at 9 = 2^3 + 1 ADC codes equally spaced from 0 to 1023
+const int32_t potTaper[9] = { 0, 546282, 674157, 761112, 830676, 887964, 938091, 983103, 1023000 };
+#endif
+
 #define VCC 4.78  // Actual voltage measured @5V PIN
 
 const uint32_t connected[] = {
@@ -83,6 +89,11 @@ AMController amController(&doWork, &doSync, &processIncomingMessages, &processOu
 AMController amController(&doWork, &doSync, &processIncomingMessages, &processOutgoingMessages, &deviceConnected, &deviceDisconnected);
 #endif
 
+// Variables sent at every loop
+AMTopic temperatureTopic("T");
+AMTopic ledTopic("Led");
+AMTopic potTopic("Pot");
+
 
 
 void setup() {
@@ -114,6 +125,20 @@ void setup() {
   analogReference();
   analogReadResolution(10);
 
+#if defined(SAMPLER_SUPPORT)
+  // Potentiometer and temperature sampled in background at 100 Hz
+  amController.samplerAddChannel(POTENTIOMETERPIN, FILTER_MOVING_AVERAGE, 8);
+  amController.samplerAddChannel(TEMPERATUREPIN, FILTER_MEDIAN, 9);
+  amController.samplerBegin(100);
+#endif
+
+#if defined(ANALOG_CHANNELS_SUPPORT)
+  // LM35: 10 mV/°C, VCC at the highest ADC code
+  amController.analogAddChannel(TEMPERATUREPIN, VCC * 100, "C");
+  amController.analogAddChannel(POTENTIOMETERPIN, 1023);
+  amController.analogLookupTable(POTENTIOMETERPIN, potTaper, 9);
+#endif
+
   //Yellow LED on
   pinMode(LEDPIN, OUTPUT);
   digitalWrite(LEDPIN, led);
@@ -133,6 +158,24 @@ void setup() {
   matrix.begin();
   matrix.loadFrame(disconnected);
 
+  // Sent to the app in a single burst when it asks for Sync
+  amController.syncVariable("S1", &led);
+
+  // Only the latest reading matters if the link is slower than updates
+  amController.conflateVariable("T");
+  amController.conflateVariable("Pot");
+
+  // Dragging the knob or the slider sends bursts of values, only the latest of each burst moves the servo or the DAC
+  amController.coalesceVariable("Knob1");
+  amController.coalesceVariable("Slider1");
+
+#if defined(PERSISTENCE_SUPPORT)
+  // LED, servo and DAC settings survive a reset
+  amController.persistVariable("S1");
+  amController.persistVariable("Knob1");
+  amController.persistVariable("Slider1");
+#endif
+
   Serial.println("Ready");
 }
 
@@ -146,14 +189,28 @@ void loop() {
 void doWork() {
   //Serial.println("doWork");
 
+#if defined(ANALOG_CHANNELS_SUPPORT)
+  amController.analogScan();
+#endif
+
   if (millis() - lastTemperatureMeasurement > 1000) {
+#if defined(ANALOG_CHANNELS_SUPPORT)
+    temperature = amController.analogValue(TEMPERATUREPIN);
+#else
     float v = getVoltage(TEMPERATUREPIN);  //getting the voltage reading from the temperature sensor
     temperature = v * 100;                 // converting voltage to temperature;
+#endif
     lastTemperatureMeasurement = millis();
   }
 
   digitalWrite(LEDPIN, led);
-  pot = analogRead(POTENTIOMETERPIN);
+#if defined(ANALOG_CHANNELS_SUPPORT)
+  pot = amController.analogMilliValue(POTENTIOMETERPIN) / ANALOG_SCALE;
+#elif defined(SAMPLER_SUPPORT)
+  pot = amController.sampledValue(POTENTIOMETERPIN);
+#else
+  pot = amController.avgAnalogRead(POTENTIOMETERPIN, 1);
+#endif
 }
 
 /**
@@ -161,8 +218,7 @@ void doWork() {
 */
 void doSync() {
   amController.writeMessage("Knob1", (float)map(servo.read(), 0, 180, 0, 1023));
-  amController.writeMessage("Slider1", (int)map(analogRead(DAC), 0, 1023, 0, 255));  // DAC is 8 bits (0..255) ADC is 10 bits (0..1023)
-  amController.writeMessage("S1", led);
+  amController.writeMessage("Slider1", (int)map(amController.avgAnalogRead(DAC, 1), 0, 1023, 0, 255));  // DAC is 8 bits (0..255) ADC is 10 bits (0..1023)
   amController.writeTxtMessage("Msg", "Hello, I'm your Arduino R4 board");
 }
 
@@ -223,9 +279,9 @@ void processIncomingMessages(char *variable, char *value) {
   This function is called periodically and messages can be sent to the iOS device
 */
 void processOutgoingMessages() {
-  amController.writeMessage("T", temperature);
-  amController.writeMessage("Led", led);
-  amController.writeMessage("Pot", pot);
+  amController.writeMessage(temperatureTopic, temperature);
+  amController.writeMessage(ledTopic, led);
+  amController.writeMessage(potTopic, pot);
 }
 
 #if defined(ALARMS_SUPPORT)
@@ -267,6 +323,10 @@ void deviceDisconnected() {
 
 */
 float getVoltage(int pin) {
-  float v = (analogRead(A1) * VCC / 1024);  // converting from a 0 to 1023 digital range to voltage
+#if defined(SAMPLER_SUPPORT)
+  float v = (amController.sampledValue(pin) * VCC / 1024);  // converting from a 0 to 1023 digital range to voltage
+#else
+  float v = (amController.avgAnalogRead(pin, 1) * VCC / 1024);  // converting from a 0 to 1023 digital range to voltage
+#endif
   return v;
 }
\ No newline at end of file
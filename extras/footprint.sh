@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# Flash and RAM used by BasicExample for each feature combination
+#
+# Requires arduino-cli with the arduino:renesas_uno core and the ArduinoBLE and Servo libraries installed
+#
+# Usage: extras/footprint.sh [sketch]
+#
+
+FQBN=arduino:renesas_uno:unor4wifi
+LIBRARY=$(cd "$(dirname "$0")/.." && pwd)
+SKETCH=${1:-$LIBRARY/examples/BasicExample}
+
+ALL="AM_NO_ALARMS AM_NO_SD AM_NO_SDLOGGEDATAGRAPH AM_NO_SAMPLER AM_NO_ANALOG_CHANNELS AM_NO_STREAMING AM_NO_STATISTICS AM_NO_PERSISTENCE AM_NO_COMPRESSION"
+
+footprint() {
+  name=$1
+  shift
+  flags=""
+  for f in "$@"; do
+    flags="$flags -D$f"
+  done
+
+  out=$(arduino-cli compile --fqbn $FQBN --library "$LIBRARY" \
+    --build-property "compiler.cpp.extra_flags=$flags" "$SKETCH" 2>&1)
+  if [ $? -ne 0 ]; then
+    printf "%-28s %10s\n" "$name" "build failed"
+    return
+  fi
+
+  flash=$(echo "$out" | sed -n 's/.*Sketch uses \([0-9]*\) bytes.*/\1/p')
+  ram=$(echo "$out" | sed -n 's/.*Global variables use \([0-9]*\) bytes.*/\1/p')
+  printf "%-28s %10s %10s\n" "$name" "$flash" "$ram"
+}
+
+# Only the given default on feature, all the others disabled
+only() {
+  flags=""
+  for f in $ALL; do
+    if [ "$f" != "AM_NO_$1" ]; then
+      flags="$flags $f"
+    fi
+  done
+  footprint "$1 only" $flags
+}
+
+printf "%-28s %10s %10s\n" "Features" "Flash [B]" "RAM [B]"
+
+footprint "all"
+footprint "none" $ALL
+for f in $ALL; do
+  only ${f#AM_NO_}
+done
+footprint "all + TCP" AM_WITH_TCP_TRANSPORT
+footprint "all + TRACE" AM_WITH_TRACE
+footprint "all + MEMORY_STATS" AM_WITH_MEMORY_STATS
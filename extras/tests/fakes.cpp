@@ -0,0 +1,171 @@
+/*
+    Fake Arduino core for the host tests: time, pins, Serial, BLE, RTC, EEPROM, SD and timers
+*/
+#include <Arduino.h>
+#include <ArduinoBLE.h>
+#include <RTC.h>
+#include <EEPROM.h>
+#include <SD.h>
+#include <FspTimer.h>
+#include <WiFiS3.h>
+#include <vector>
+#include "fakes.h"
+
+unsigned long fakeMillis = 1000, fakeMicrosExtra = 0;
+unsigned long millis() { return fakeMillis; }
+unsigned long micros() { return fakeMillis * 1000 + fakeMicrosExtra; }
+void delay(unsigned long ms) { fakeMillis += ms; }
+void delayMicroseconds(unsigned int) {}
+int fakeAnalog[32];
+int analogRead(uint8_t p) { return fakeAnalog[p % 32]; }
+int fakePinOut[32];
+void analogWrite(uint8_t p, int v) { fakePinOut[p % 32] = v; }
+void analogReference() {}
+void analogReadResolution(int) {}
+void analogWriteResolution(int) {}
+void digitalWrite(uint8_t p, uint8_t v) { fakePinOut[p % 32] = v; }
+int digitalRead(uint8_t p) { return fakePinOut[p % 32]; }
+void pinMode(uint8_t, uint8_t) {}
+long map(long x, long a, long b, long c, long d) { return (x - a) * (d - c) / (b - a) + c; }
+char *itoa(int v, char *b, int) { sprintf(b, "%d", v); return b; }
+char *ltoa(long v, char *b, int) { sprintf(b, "%ld", v); return b; }
+char *ultoa(unsigned long v, char *b, int) { sprintf(b, "%lu", v); return b; }
+void noInterrupts() {}
+void interrupts() {}
+String::String(const char *s) { _s = strdup(s); }
+String::String(int v) : String(std::to_string(v).c_str()) {}
+const char *String::c_str() const { return _s; }
+String String::operator+(const String &o) const { return String((std::string(c_str()) + o.c_str()).c_str()); }
+String operator+(const char *a, const String &b) { return String((std::string(a) + b.c_str()).c_str()); }
+size_t Print::write(const uint8_t *b, size_t n) { for (size_t i = 0; i < n; i++) write(b[i]); return n; }
+size_t Print::print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+size_t Print::print(const String &s) { return print(s.c_str()); }
+size_t Print::print(char c) { return write((uint8_t)c); }
+size_t Print::print(int v, int) { char b[20]; sprintf(b, "%d", v); return print(b); }
+size_t Print::print(unsigned int v, int) { char b[20]; sprintf(b, "%u", v); return print(b); }
+size_t Print::print(long v, int) { char b[20]; sprintf(b, "%ld", v); return print(b); }
+size_t Print::print(unsigned long v, int) { char b[20]; sprintf(b, "%lu", v); return print(b); }
+size_t Print::print(double v, int d) { char b[40]; sprintf(b, "%.*f", d, v); return print(b); }
+size_t Print::println(const char *s) { return print(s) + println(); }
+size_t Print::println(const String &s) { return print(s) + println(); }
+size_t Print::println(int v, int b) { return print(v, b) + println(); }
+size_t Print::println(unsigned long v, int b) { return print(v, b) + println(); }
+size_t Print::println(long v, int b) { return print(v, b) + println(); }
+size_t Print::println(double v, int b) { return print(v, b) + println(); }
+size_t Print::println() { return print("\r\n"); }
+size_t Stream::readBytes(uint8_t *b, size_t n) { size_t i = 0; while (i < n && available()) b[i++] = read(); return i; }
+size_t Stream::readBytes(char *b, size_t n) { return readBytes((uint8_t *)b, n); }
+size_t Stream::readBytesUntil(char t, char *b, size_t n) { size_t i = 0; while (i < n && available()) { int c = read(); if (c == t) break; b[i++] = c; } return i; }
+std::string serialOut;
+size_t HardwareSerial::write(uint8_t c) { serialOut += (char)c; return 1; }
+int HardwareSerial::available() { return 0; }
+int HardwareSerial::read() { return -1; }
+int HardwareSerial::peek() { return -1; }
+void HardwareSerial::begin(unsigned long) {}
+HardwareSerial::operator bool() { return true; }
+HardwareSerial Serial;
+// BLE
+BLEService::BLEService(const char *) {}
+void BLEService::addCharacteristic(BLECharacteristic &) {}
+BLECharacteristic::BLECharacteristic() {}
+BLECharacteristic::BLECharacteristic(const char *, uint8_t, int, bool) {}
+int BLECharacteristic::readValue(void *, int) { return 0; }
+int BLECharacteristic::writeValue(const uint8_t *, int, bool) { return 1; }
+int BLECharacteristic::writeValue(const void *, int, bool) { return 1; }
+void BLECharacteristic::setEventHandler(int, BLECharacteristicEventHandler) {}
+int BLECharacteristic::subscribed() { return 1; }
+int BLECharacteristic::valueLength() const { return 0; }
+const uint8_t *BLECharacteristic::value() const { return 0; }
+BLEUnsignedCharCharacteristic::BLEUnsignedCharCharacteristic(const char *, uint8_t) {}
+int BLEUnsignedCharCharacteristic::writeValue(unsigned char) { return 1; }
+String BLEDevice::address() const { return String("x"); }
+bool BLEDevice::connected() const { return true; }
+BLEDevice::operator bool() const { return true; }
+static BLELocalDevice bleDev;
+BLELocalDevice &BLE = bleDev;
+int BLELocalDevice::begin() { return 1; }
+void BLELocalDevice::poll() {}
+void BLELocalDevice::poll(unsigned long) {}
+bool BLELocalDevice::setLocalName(const char *) { return true; }
+void BLELocalDevice::setDeviceName(const char *) {}
+void BLELocalDevice::setAdvertisedService(const BLEService &) {}
+void BLELocalDevice::addService(BLEService &) {}
+int BLELocalDevice::advertise() { return 1; }
+void BLELocalDevice::stopAdvertise() {}
+BLEDevice BLELocalDevice::central() { return BLEDevice(); }
+void BLELocalDevice::setEventHandler(int, BLEDeviceEventHandler) {}
+uint16_t bleMinInterval = 0, bleMaxInterval = 0, bleSupervisionTimeout = 0;
+void BLELocalDevice::setConnectionInterval(uint16_t a, uint16_t b) { bleMinInterval = a; bleMaxInterval = b; }
+void BLELocalDevice::setSupervisionTimeout(uint16_t t) { bleSupervisionTimeout = t; }
+bool BLELocalDevice::connected() const { return true; }
+bool BLELocalDevice::disconnect() { return true; }
+// RTC
+time_t rtcBase = 946684800; unsigned long rtcMillisBase = 0;
+RTCTime::RTCTime() {}
+RTCTime::RTCTime(time_t t) { _t = t; }
+time_t RTCTime::getUnixTime() { return _t; }
+void RTCTime::setUnixTime(time_t t) { _t = t; }
+String RTCTime::toString() const { return String(std::to_string(_t).c_str()); }
+RTCTime::operator String() const { return toString(); }
+void AlarmMatch::addMatchSecond() {} void AlarmMatch::addMatchMinute() {} void AlarmMatch::addMatchHour() {}
+void AlarmMatch::addMatchDay() {} void AlarmMatch::addMatchMonth() {} void AlarmMatch::addMatchYear() {}
+RTClock RTC;
+int rtcGetTimeCalls = 0;
+rtc_cbk_t rtcAlarmCb = 0; time_t rtcAlarmAt = 0; rtc_cbk_t rtcPeriodicCb = 0;
+bool RTClock::begin() { return true; }
+bool RTClock::getTime(RTCTime &t) { rtcGetTimeCalls++; t.setUnixTime(rtcBase + (millis() - rtcMillisBase) / 1000); return true; }
+bool RTClock::setTime(RTCTime &t) { rtcBase = t.getUnixTime(); rtcMillisBase = millis(); return true; }
+bool RTClock::setPeriodicCallback(rtc_cbk_t c, Period) { rtcPeriodicCb = c; return true; }
+bool RTClock::setAlarmCallback(rtc_cbk_t c, RTCTime &t, AlarmMatch &) { rtcAlarmCb = c; rtcAlarmAt = t.getUnixTime(); return true; }
+bool RTClock::setAlarm(RTCTime &t, AlarmMatch &) { rtcAlarmAt = t.getUnixTime(); return true; }
+bool RTClock::isRunning() { return true; }
+// EEPROM
+uint8_t eeprom[8192];
+uint8_t EEPROMClass::read(int a) { return eeprom[a]; }
+void EEPROMClass::write(int a, uint8_t v) { eeprom[a] = v; }
+void EEPROMClass::update(int a, uint8_t v) { eeprom[a] = v; }
+uint16_t EEPROMClass::length() { return 8192; }
+EEPROMClass EEPROM;
+// SD
+std::map<std::string, std::string> sdFiles;
+struct FState { std::string name; size_t pos; bool open; bool dir; size_t dirIdx; };
+std::vector<FState> fst;
+static FState &F(const File *f) { static FState none; if (f->_id < 0) { none = {"",0,false,false,0}; return none; } return fst[f->_id]; }
+static File mk(std::string n, bool dir) { File f; fst.push_back({n, 0, true, dir, 0}); f._id = fst.size() - 1; return f; }
+size_t File::write(uint8_t c) { sdFiles[F(this).name] += (char)c; return 1; }
+size_t File::write(const uint8_t *b, size_t n) { sdFiles[F(this).name].append((const char *)b, n); return n; }
+int File::available() { auto &s = F(this); if (!s.open || s.dir) return 0; return sdFiles[s.name].size() - s.pos; }
+int File::read() { auto &s = F(this); if (!available()) return -1; return (uint8_t)sdFiles[s.name][s.pos++]; }
+int File::read(void *b, uint16_t n) { int k = 0; while (k < n && available()) ((uint8_t *)b)[k++] = read(); return k; }
+int File::peek() { return -1; }
+void File::flush() {}
+bool File::seek(uint32_t p) { F(this).pos = p; return true; }
+uint32_t File::position() { return F(this).pos; }
+uint32_t File::size() { return sdFiles[F(this).name].size(); }
+void File::close() { F(this).open = false; }
+File::operator bool() { return F(this).open; }
+char *File::name() { auto &n = F(this).name; return (char *)n.c_str() + (n[0] == '/'); }
+bool File::isDirectory() { return F(this).dir; }
+File File::openNextFile(uint8_t) { auto &s = F(this); size_t i = 0; for (auto &kv : sdFiles) { if (i++ == s.dirIdx) { s.dirIdx++; return mk(kv.first, false); } } return File(); }
+void File::rewindDirectory() { F(this).dirIdx = 0; }
+int sdOpens = 0;
+static std::string norm(const char *n) { std::string s(n); if (s[0] != '/') s = "/" + s; return s; }
+bool SDClass::begin(uint8_t) { return true; }
+File SDClass::open(const char *n, uint8_t mode) { sdOpens++; std::string s = norm(n); if (s == "/") return mk(s, true); if (mode == FILE_WRITE) { sdFiles[s]; File f = mk(s, false); F(&f).pos = sdFiles[s].size(); return f; } if (!sdFiles.count(s)) return File(); return mk(s, false); }
+bool SDClass::remove(const char *n) { return sdFiles.erase(norm(n)) > 0; }
+bool SDClass::exists(const char *n) { return sdFiles.count(norm(n)) > 0; }
+SDClass SD;
+// FspTimer
+void (*fspCb)(timer_callback_args_t *) = 0;
+int8_t FspTimer::get_available_timer(uint8_t &t, bool) { t = 0; return 1; }
+bool FspTimer::begin(timer_mode_t, uint8_t, uint8_t, float, float, void (*cb)(timer_callback_args_t *), void *) { fspCb = cb; return true; }
+bool FspTimer::setup_overflow_irq(uint8_t) { return true; }
+bool FspTimer::open() { return true; }
+bool FspTimer::start() { return true; }
+bool FspTimer::stop() { return true; }
+bool FspTimer::close() { return true; }
+bool FspTimer::set_frequency(float) { return true; }
+#ifdef AM_WITH_MEMORY_STATS
+extern "C" { char fakeMem[1024]; }
+asm(".globl __StackLimit\n.set __StackLimit, fakeMem\n.globl __StackTop\n.set __StackTop, fakeMem+512\n.globl __HeapBase\n.set __HeapBase, fakeMem+512\n.globl __HeapLimit\n.set __HeapLimit, fakeMem+1024\n");
+#endif
@@ -0,0 +1,30 @@
+/*
+    State of the fake Arduino core used by the host tests (see run.sh)
+*/
+#pragma once
+
+#include <map>
+#include <string>
+#include <Arduino.h>
+#include <RTC.h>
+
+extern unsigned long fakeMillis;        // millis(), advanced by delay()
+extern unsigned long fakeMicrosExtra;   // micros() = fakeMillis * 1000 + fakeMicrosExtra
+extern int fakeAnalog[32];              // analogRead() results
+extern int fakePinOut[32];              // digitalWrite() / analogWrite() values
+extern std::string serialOut;           // Everything printed on Serial
+
+extern uint16_t bleMinInterval, bleMaxInterval;  // Last BLE.setConnectionInterval()
+extern uint16_t bleSupervisionTimeout;           // Last BLE.setSupervisionTimeout()
+
+extern time_t rtcBase;                  // RTC time at rtcMillisBase
+extern unsigned long rtcMillisBase;
+extern int rtcGetTimeCalls;
+extern rtc_cbk_t rtcAlarmCb;            // Last RTC.setAlarmCallback()
+extern time_t rtcAlarmAt;
+extern rtc_cbk_t rtcPeriodicCb;
+
+extern uint8_t eeprom[8192];
+
+extern std::map<std::string, std::string> sdFiles;  // SD card content, names start with /
+extern int sdOpens;
@@ -0,0 +1,37 @@
+#!/bin/sh
+#
+# Host tests: the library is built with the stub Arduino core in stubs/ and fakes.cpp,
+# no board or radio needed. Each test_*.cpp is a program returning the number of failures.
+# Build flags of a test go in a "// FLAGS:" line (e.g. // FLAGS: -DAM_WITH_TRACE)
+#
+#   extras/tests/run.sh              all the tests
+#   extras/tests/run.sh test_parser  only some of them
+#
+
+cd "$(dirname "$0")" || exit 1
+
+CXX=${CXX:-g++}
+OUT=${TMPDIR:-/tmp}/am_tests
+mkdir -p "$OUT"
+
+if [ $# -eq 0 ]; then
+  set -- $(ls test_*.cpp | sed 's/\.cpp$//')
+fi
+
+failed=0
+for t in "$@"; do
+  flags=$(sed -n 's#^// FLAGS: ##p' "$t.cpp")
+  if ! $CXX -std=gnu++17 -g -O1 -fsanitize=address,undefined -Wno-deprecated-declarations \
+      -DARDUINO_UNOR4_WIFI $flags -Istubs -I../../src \
+      "$t.cpp" fakes.cpp ../../src/*.cpp -o "$OUT/$t"; then
+    echo "FAIL $t (build)"
+    failed=$((failed + 1))
+  elif ASAN_OPTIONS=detect_leaks=0 "$OUT/$t"; then
+    echo "ok   $t"
+  else
+    echo "FAIL $t"
+    failed=$((failed + 1))
+  fi
+done
+
+exit $failed
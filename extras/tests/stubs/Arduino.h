@@ -0,0 +1,90 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+typedef bool boolean;
+typedef uint8_t byte;
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+#define A0 14
+#define A1 15
+#define A2 16
+#define DAC A0
+#define LED_BUILTIN 13
+template<class T, class L> auto min(const T &a, const L &b) -> decltype((b < a) ? b : a) { return (b < a) ? b : a; }
+template<class T, class L> auto max(const T &a, const L &b) -> decltype((b < a) ? b : a) { return (a < b) ? b : a; }
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+int analogRead(uint8_t);
+void analogWrite(uint8_t, int);
+void analogReference();
+void analogReadResolution(int);
+void analogWriteResolution(int);
+void digitalWrite(uint8_t, uint8_t);
+int digitalRead(uint8_t);
+void pinMode(uint8_t, uint8_t);
+long map(long, long, long, long, long);
+char *itoa(int, char *, int);
+char *ltoa(long, char *, int);
+char *ultoa(unsigned long, char *, int);
+void noInterrupts();
+void interrupts();
+class String {
+public:
+  String(const char * = "");
+  String(int);
+  const char *c_str() const;
+  String operator+(const String &) const;
+  friend String operator+(const char *, const String &);
+private:
+  char *_s;
+};
+class Print {
+public:
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *b, size_t n);
+  size_t print(const char *);
+  size_t print(const String &);
+  size_t print(char);
+  size_t print(int, int = 10);
+  size_t print(unsigned int, int = 10);
+  size_t print(long, int = 10);
+  size_t print(unsigned long, int = 10);
+  size_t print(double, int = 2);
+  size_t println(const char *);
+  size_t println(const String &);
+  size_t println(int, int = 10);
+  size_t println(unsigned long, int = 10);
+  size_t println(long, int = 10);
+  size_t println(double, int = 2);
+  size_t println();
+  virtual void flush() {}
+};
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  size_t readBytes(uint8_t *, size_t);
+  size_t readBytes(char *, size_t);
+  size_t readBytesUntil(char, char *, size_t);
+};
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long);
+  size_t write(uint8_t);
+  using Print::write;
+  int available();
+  int read();
+  int peek();
+  operator bool();
+};
+extern HardwareSerial Serial;
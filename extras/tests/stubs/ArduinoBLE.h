@@ -0,0 +1,46 @@
+#pragma once
+#include <Arduino.h>
+enum { BLEBroadcast = 0x01, BLERead = 0x02, BLEWriteWithoutResponse = 0x04, BLEWrite = 0x08, BLENotify = 0x10, BLEIndicate = 0x20 };
+enum BLEDeviceEvent { BLEConnected = 0, BLEDisconnected = 1 };
+enum BLECharacteristicEvent { BLESubscribed = 0, BLEUnsubscribed = 1, BLEWritten = 3 };
+class BLEDevice { public: String address() const; bool connected() const; operator bool() const; };
+class BLECharacteristic;
+typedef void (*BLEDeviceEventHandler)(BLEDevice);
+typedef void (*BLECharacteristicEventHandler)(BLEDevice, BLECharacteristic);
+class BLECharacteristic {
+public:
+  BLECharacteristic();
+  BLECharacteristic(const char *uuid, uint8_t props, int valueSize, bool fixed = false);
+  int readValue(void *, int);
+  int writeValue(const uint8_t *, int, bool withResponse = true);
+  int writeValue(const void *, int, bool withResponse = true);
+  int valueLength() const;
+  const uint8_t *value() const;
+  void setEventHandler(int, BLECharacteristicEventHandler);
+  int subscribed();
+};
+class BLEUnsignedCharCharacteristic : public BLECharacteristic {
+public:
+  BLEUnsignedCharCharacteristic(const char *, uint8_t);
+  int writeValue(unsigned char);
+};
+class BLEService { public: BLEService(const char *); void addCharacteristic(BLECharacteristic &); };
+class BLELocalDevice {
+public:
+  int begin();
+  void poll();
+  void poll(unsigned long);
+  bool setLocalName(const char *);
+  void setDeviceName(const char *);
+  void setAdvertisedService(const BLEService &);
+  void addService(BLEService &);
+  int advertise();
+  void stopAdvertise();
+  BLEDevice central();
+  void setEventHandler(int, BLEDeviceEventHandler);
+  void setConnectionInterval(uint16_t, uint16_t);
+  void setSupervisionTimeout(uint16_t);
+  bool connected() const;
+  bool disconnect();
+};
+extern BLELocalDevice &BLE;
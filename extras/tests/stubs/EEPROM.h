@@ -0,0 +1,8 @@
+#pragma once
+#include <Arduino.h>
+struct EEPROMClass {
+  template<typename T> T &get(int a, T &t) { for (size_t i = 0; i < sizeof(T); i++) ((uint8_t *)&t)[i] = read(a + i); return t; }
+  template<typename T> const T &put(int a, const T &t) { for (size_t i = 0; i < sizeof(T); i++) write(a + i, ((const uint8_t *)&t)[i]); return t; }
+  uint8_t read(int); void write(int, uint8_t); void update(int, uint8_t); uint16_t length();
+};
+extern EEPROMClass EEPROM;
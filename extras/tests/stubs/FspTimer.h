@@ -0,0 +1,11 @@
+#pragma once
+#include <Arduino.h>
+typedef struct { void *p_context; } timer_callback_args_t;
+typedef enum { TIMER_MODE_PERIODIC } timer_mode_t;
+class FspTimer {
+public:
+  static int8_t get_available_timer(uint8_t &type, bool force = false);
+  bool begin(timer_mode_t, uint8_t, uint8_t, float freq, float duty, void (*cb)(timer_callback_args_t *), void *ctx = nullptr);
+  bool setup_overflow_irq(uint8_t priority = 12);
+  bool open(); bool start(); bool stop(); bool close(); bool set_frequency(float);
+};
@@ -0,0 +1,33 @@
+#pragma once
+#include <Arduino.h>
+enum class Period { ONCE_EVERY_2_SEC, ONCE_EVERY_1_SEC, N2_TIMES_EVERY_SEC };
+enum class Month { JANUARY };
+enum class DayOfWeek { MONDAY };
+enum class SaveLight { SAVING_TIME_INACTIVE };
+class RTCTime {
+public:
+  RTCTime();
+  RTCTime(time_t);
+  time_t getUnixTime();
+  void setUnixTime(time_t);
+  String toString() const;
+  operator String() const;
+private:
+  time_t _t = 0;
+};
+class AlarmMatch {
+public:
+  void addMatchSecond(); void addMatchMinute(); void addMatchHour(); void addMatchDay(); void addMatchMonth(); void addMatchYear();
+};
+typedef void (*rtc_cbk_t)();
+class RTClock {
+public:
+  bool begin();
+  bool getTime(RTCTime &);
+  bool setTime(RTCTime &);
+  bool setPeriodicCallback(rtc_cbk_t, Period);
+  bool setAlarmCallback(rtc_cbk_t, RTCTime &, AlarmMatch &);
+  bool setAlarm(RTCTime &, AlarmMatch &);
+  bool isRunning();
+};
+extern RTClock RTC;
@@ -0,0 +1,14 @@
+#pragma once
+#include <Arduino.h>
+#define FILE_READ 0
+#define FILE_WRITE 1
+class File : public Stream {
+public:
+  int _id = -1;
+  size_t write(uint8_t); size_t write(const uint8_t *, size_t);
+  int read(); int read(void *, uint16_t); int peek(); int available(); void flush();
+  bool seek(uint32_t); uint32_t position(); uint32_t size(); void close(); operator bool();
+  char *name(); bool isDirectory(); File openNextFile(uint8_t mode = 0); void rewindDirectory();
+};
+class SDClass { public: bool begin(uint8_t); File open(const char *, uint8_t = FILE_READ); bool remove(const char *); bool exists(const char *); };
+extern SDClass SD;
@@ -0,0 +1,4 @@
+#pragma once
+#include <Arduino.h>
+class WiFiClient : public Stream { public: size_t write(uint8_t); size_t write(const uint8_t *, size_t); int available(); int read(); int read(uint8_t *, size_t); int peek(); uint8_t connected(); void stop(); operator bool(); void setNoDelay(bool); };
+class WiFiServer { public: WiFiServer(int); void begin(); WiFiClient available(); };
@@ -0,0 +1,24 @@
+/*
+    Minimal checks for the host tests, main() returns the number of failures
+*/
+#pragma once
+
+#include <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while (0)
+
+#define CHECK_STR(a, b) \
+  do { \
+    if (strcmp((a), (b)) != 0) { \
+      printf("%s:%d: \"%s\" != \"%s\"\n", __FILE__, __LINE__, (a), (b)); \
+      failures++; \
+    } \
+  } while (0)
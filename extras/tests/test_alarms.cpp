@@ -0,0 +1,93 @@
+/*
+    Alarms set by the app, fired through the fake RTC alarm callback
+*/
+#include <string>
+#include "AM_UnoR4Ble.h"
+#include "fakes.h"
+#include "test.h"
+
+static std::string fired;
+
+void doWork() {}
+void doSync() {}
+void processIncomingMessages(char *variable, char *value) {}
+void processOutgoingMessages() {}
+void processAlarms(char *alarm) {
+  fired += std::string(alarm) + ";";
+}
+void deviceConnected() {}
+void deviceDisconnected() {}
+
+static void setAlarm(AMLoopbackTransport &loopback, AMController &controller, const char *id, unsigned long time, bool repeat) {
+  char message[80];
+  snprintf(message, sizeof(message), "$AlarmId$=%s#$AlarmT$=%lu#$AlarmR$=%d#", id, time, repeat ? 1 : 0);
+  loopback.inject(message);
+  controller.loop();
+}
+
+int main() {
+  const unsigned long t0 = 1700000000;
+
+  // Without an alarm callback, alarms from the app and leftovers in EEPROM are never evaluated
+  {
+    eeprom[0] = 'A';
+    eeprom[1] = 'X';  // Due since 1970
+    AMLoopbackTransport loopback;
+    AMController controller(&doWork, &doSync, &processIncomingMessages, &processOutgoingMessages, &deviceConnected, &deviceDisconnected);
+    controller.setTransport(&loopback);
+    controller.begin();
+    loopback.connect();
+    loopback.inject("$Time$=1700000000#");
+    controller.loop();
+    setAlarm(loopback, controller, "1", t0 - 10, false);
+    setAlarm(loopback, controller, "2", t0 + 10, false);
+    fakeMillis += 20000;
+    controller.loop();
+    CHECK(rtcAlarmCb == NULL);
+    CHECK(fired.empty());
+  }
+
+  memset(eeprom, 0xFF, sizeof(eeprom));
+  AMLoopbackTransport loopback;
+  AMController controller(&doWork, &doSync, &processIncomingMessages, &processOutgoingMessages, &processAlarms, &deviceConnected, &deviceDisconnected);
+  controller.setTransport(&loopback);
+  controller.begin();
+  loopback.connect();
+  loopback.inject("$Time$=1700000000#");
+  controller.loop();
+
+  // The RTC alarm is programmed for the first alarm due
+  setAlarm(loopback, controller, "7", t0 + 100, false);
+  setAlarm(loopback, controller, "8", t0 + 200, true);
+  CHECK(rtcAlarmCb != NULL);
+  CHECK(rtcAlarmAt == (time_t)(t0 + 100));
+  controller.loop();
+  CHECK(fired.empty());
+
+  fakeMillis += 100000;
+  rtcAlarmCb();
+  controller.loop();
+  CHECK(fired == "7;");
+  CHECK(rtcAlarmAt == (time_t)(t0 + 200));
+
+  // Repeated alarms are programmed again for the next day
+  fakeMillis += 100000;
+  rtcAlarmCb();
+  controller.loop();
+  CHECK(fired == "7;8;");
+  CHECK(rtcAlarmAt == (time_t)(t0 + 200 + 86400));
+
+  // Removed alarms are not fired
+  setAlarm(loopback, controller, "8", 0, false);
+  fakeMillis += 86400000UL;
+  rtcAlarmCb();
+  controller.loop();
+  CHECK(fired == "7;8;");
+
+  // Alarms already due fire without waiting for the RTC
+  setAlarm(loopback, controller, "9", t0, false);
+  controller.loop();
+  CHECK(fired == "7;8;9;");
+
+  return failures;
+}
@@ -0,0 +1,63 @@
+/*
+    Coalesced input: only the latest value of a burst is delivered, in arrival order with
+    the other messages, and values kept are discarded when the app disconnects
+*/
+#include <string>
+#include "AM_UnoR4Ble.h"
+#include "fakes.h"
+#include "test.h"
+
+std::string received;
+
+void doWork() {}
+void doSync() {}
+void processIncomingMessages(char *variable, char *value) {
+  received += std::string(variable) + "=" + value + ";";
+}
+void processOutgoingMessages() {}
+void deviceConnected() {}
+void deviceDisconnected() {}
+
+AMLoopbackTransport loopback;
+AMController amController(&doWork, &doSync, &processIncomingMessages, &processOutgoingMessages, &deviceConnected, &deviceDisconnected);
+
+// Parsed as a single batch
+void receive(const char *data) {
+  amController.dataAvailable(data, strlen(data));
+  amController.loop();
+}
+
+int main() {
+  amController.setTransport(&loopback);
+  CHECK(amController.coalesceVariable("Slider1"));
+  CHECK(amController.coalesceVariable("Knob1"));
+  amController.begin();
+  loopback.connect();
+  amController.loop();
+
+  // A button press splits the burst: the value kept before it is delivered first
+  received = "";
+  receive("Slider1=1#Slider1=2#Push1=1#Slider1=3#");
+  CHECK_STR(received.c_str(), "Slider1=2;Push1=1;Slider1=3;");
+
+  // Several coalesced variables, in the order of their first value
+  received = "";
+  receive("Knob1=1#Slider1=4#Knob1=2#Slider1=5#");
+  CHECK_STR(received.c_str(), "Knob1=2;Slider1=5;");
+  CHECK(amController.coalescedMessages() == 3);
+
+  // Values kept within the window are discarded on disconnection, not delivered in the next session
+  received = "";
+  amController.setCoalesceWindow(1000);
+  receive("Slider1=6#");
+  CHECK_STR(received.c_str(), "");
+  loopback.disconnect();
+  amController.loop();
+  loopback.connect();
+  fakeMillis += 2000;
+  amController.loop();
+  receive("Push1=0#");
+  CHECK_STR(received.c_str(), "Push1=0;");
+
+  return failures;
+}
@@ -0,0 +1,104 @@
+/*
+    LZSS compressor: round trip through a reference decoder of the format described in AM_Compressor.h,
+    output size bound and compression ratios of typical data
+*/
+#include <string>
+#include <vector>
+#include "AM_UnoR4Ble.h"
+#include "test.h"
+
+// Decodes one frame, appending to out, which holds the whole transfer so far
+static bool decode(const uint8_t *in, size_t l, std::vector<uint8_t> &out) {
+  size_t i = 0;
+
+  while (i < l) {
+    uint8_t flag = in[i++];
+
+    for (uint8_t bit = 0; bit < 8 && i < l; bit++) {
+      if (flag & (1 << bit)) {
+        out.push_back(in[i++]);
+        continue;
+      }
+      if (i + 2 > l) {
+        return false;
+      }
+      uint16_t distance = in[i] | ((in[i + 1] >> 4) << 8);
+      uint8_t length = (in[i + 1] & 0x0F) + 3;
+      i += 2;
+      if (distance == 0 || distance > out.size()) {
+        return false;
+      }
+      for (uint8_t k = 0; k < length; k++) {
+        out.push_back(out[out.size() - distance]);
+      }
+    }
+  }
+  return true;
+}
+
+// Compresses data in frames of BULK_FRAME_SIZE bytes, as the bulk transfers do, returns the ratio
+static double roundTrip(const char *name, const std::vector<uint8_t> &data) {
+  static AMCompressor compressor;
+  std::vector<uint8_t> decoded;
+  uint8_t packed[BULK_FRAME_SIZE + (BULK_FRAME_SIZE + 7) / 8];
+  size_t total = 0;
+  bool ok = true;
+
+  compressor.begin();
+  for (size_t i = 0; i < data.size(); i += BULK_FRAME_SIZE) {
+    size_t n = std::min(data.size() - i, (size_t)BULK_FRAME_SIZE);
+    size_t k = compressor.compress(&data[i], n, packed);
+    CHECK(k <= n + (n + 7) / 8);
+    ok = ok && decode(packed, k, decoded);
+    total += k;
+  }
+
+  CHECK(ok);
+  CHECK(decoded == data);
+
+  double ratio = (double)data.size() / total;
+  printf("  %-10s %6zu -> %6zu bytes, %.2fx\n", name, data.size(), total, ratio);
+  return ratio;
+}
+
+int main() {
+  std::vector<uint8_t> data;
+
+  // Logged data: slowly changing values, one line per sample
+  std::string csv;
+  for (int i = 0; i < 1000; i++) {
+    char line[64];
+    snprintf(line, sizeof(line), "%lu;%.2f;%.2f;-;-;-\n", 1700000000UL + i * 10, 21.5 + (i % 40) * 0.05, 1013.0 + (i % 7) * 0.25);
+    csv += line;
+  }
+  data.assign(csv.begin(), csv.end());
+  CHECK(roundTrip("csv", data) > 2.0);
+
+  srand(1);
+  data.clear();
+  for (int i = 0; i < 20000; i++) {
+    data.push_back(rand() & 0xFF);
+  }
+  CHECK(roundTrip("random", data) > 0.85);
+
+  data.assign(20000, 'A');
+  CHECK(roundTrip("repeated", data) > 5.0);
+
+  data.clear();
+  for (int i = 0; i < 20000; i++) {
+    data.push_back("0123456789"[i % 7]);
+  }
+  CHECK(roundTrip("periodic", data) > 5.0);
+
+  // Short frames and the empty one
+  AMCompressor compressor;
+  uint8_t packed[8];
+  std::vector<uint8_t> decoded;
+  compressor.begin();
+  CHECK(compressor.compress((const uint8_t *)"", 0, packed) == 0);
+  CHECK(compressor.compress((const uint8_t *)"ab", 2, packed) == 3);
+  CHECK(decode(packed, 3, decoded));
+  CHECK(std::string(decoded.begin(), decoded.end()) == "ab");
+
+  return failures;
+}
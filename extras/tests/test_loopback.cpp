@@ -0,0 +1,62 @@
+/*
+    Loopback transport: messages in both directions and a benchmark of the TX path without any radio
+*/
+#include <chrono>
+#include <string>
+#include "AM_UnoR4Ble.h"
+#include "fakes.h"
+#include "test.h"
+
+static std::string received;
+
+void doWork() {}
+void doSync() {}
+void processIncomingMessages(char *variable, char *value) {
+  received += std::string(variable) + "=" + value + ";";
+}
+void processOutgoingMessages() {}
+void deviceConnected() {}
+void deviceDisconnected() {}
+
+AMLoopbackTransport loopback;
+AMController amController(&doWork, &doSync, &processIncomingMessages, &processOutgoingMessages, &deviceConnected, &deviceDisconnected);
+
+int main() {
+  amController.setTransport(&loopback);
+  amController.begin();
+  loopback.connect();
+
+  // App to board, split in BLE sized packets
+  loopback.inject("S1=1#Knob1=512#Msg=hello#");
+  amController.loop();
+  CHECK(received == "S1=1;Knob1=512;Msg=hello;");
+
+  // Board to app, packed
+  amController.writeMessage("Led", 1);
+  amController.writeMessage("T", 23.5f);
+  amController.loop();
+  CHECK_STR(loopback.sent(), "Led=1#T=23.50000#");
+  CHECK(loopback.sentPackets() == 1);
+
+  // Benchmark: 10 messages per loop()
+  const int loops = 2000;
+  unsigned long packets = 0;
+  unsigned long bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < loops; i++) {
+    loopback.clear();
+    for (int j = 0; j < 10; j++) {
+      amController.writeMessage("Pot", i + j);
+    }
+    amController.loop();
+    packets += loopback.sentPackets();
+    bytes += loopback.sentLength();
+  }
+  double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+  CHECK(bytes > 0);
+  printf("  %d messages: %lu packets, %lu bytes, %.2f packets/message, %.2f us/message on the host\n",
+         loops * 10, packets, bytes, (double)packets / (loops * 10), us / (loops * 10));
+
+  return failures;
+}
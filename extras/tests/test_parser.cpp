@@ -0,0 +1,73 @@
+/*
+    Incremental parser: messages split across writes, names and values too long for
+    the buffers, values passed whole with setValueBufferSize() or in chunks to the
+    long value handler
+*/
+#include <string>
+#include "AM_UnoR4Ble.h"
+#include "fakes.h"
+#include "test.h"
+
+std::string received;
+
+void doWork() {}
+void doSync() {}
+void processIncomingMessages(char *variable, char *value) {
+  received += std::string(variable) + "=" + value + ";";
+}
+void processOutgoingMessages() {}
+void deviceConnected() {}
+void deviceDisconnected() {}
+
+void longValue(const char *variable, AMValueChunk chunk, const char *data, uint16_t length) {
+  const char *names[] = { "BEGIN", "DATA", "END", "ABORT" };
+  received += std::string(variable) + " " + names[chunk];
+  if (chunk == VALUE_DATA)
+    received += " " + std::string(data, length);
+  received += ";";
+}
+
+AMLoopbackTransport loopback;
+AMController amController(&doWork, &doSync, &processIncomingMessages, &processOutgoingMessages, &deviceConnected, &deviceDisconnected);
+
+int main() {
+  amController.setTransport(&loopback);
+  amController.begin();
+  loopback.connect();
+  amController.loop();
+
+  // Messages split anywhere, values truncated at VALUELEN
+  loopback.inject("A=1#B=");
+  loopback.inject("1234567890123456789#C");
+  loopback.inject("=2#");
+  CHECK_STR(received.c_str(), "A=1;B=12345678901234;C=2;");
+
+  // Name longer than VARIABLELEN and message without a value discarded up to the next #
+  received = "";
+  loopback.inject("VeryLongVariableName=3#D=4#junk#E=5#");
+  CHECK_STR(received.c_str(), "D=4;E=5;");
+
+  // Larger buffer, allocated once
+  received = "";
+  CHECK(amController.setValueBufferSize(40));
+  CHECK(!amController.setValueBufferSize(80));
+  loopback.inject("Json={\"a\":1,\"b\":[1,2,3]}#F=6#");
+  CHECK_STR(received.c_str(), "Json={\"a\":1,\"b\":[1,2,3]};F=6;");
+
+  // Values longer than the buffer delivered in chunks as they arrive
+  received = "";
+  amController.setLongValueHandler(longValue);
+  loopback.inject("Big=0123456789012345678901234567890123456789abc");
+  loopback.inject("def#G=7#");
+  CHECK_STR(received.c_str(), "Big BEGIN;Big DATA 0123456789012345678901234567890123456789;Big DATA abc;Big DATA def;Big END;G=7;");
+
+  // Value interrupted by the disconnection, the next connection starts clean
+  received = "";
+  loopback.inject("Big=0123456789012345678901234567890123456789x");
+  loopback.disconnect();
+  loopback.connect();
+  loopback.inject("H=8#");
+  CHECK_STR(received.c_str(), "Big BEGIN;Big DATA 0123456789012345678901234567890123456789;Big DATA x;Big ABORT;H=8;");
+
+  return failures;
+}
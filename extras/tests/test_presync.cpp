@@ -0,0 +1,48 @@
+/*
+    Samples logged before the app sets the clock: times at or before 1/1/2000 are discarded,
+    the others are held and written with the right time once $Time$ arrives
+*/
+#include <string>
+#include "AM_UnoR4Ble.h"
+#include "fakes.h"
+#include "test.h"
+
+void doWork() {}
+void doSync() {}
+void processIncomingMessages(char *variable, char *value) {}
+void processOutgoingMessages() {}
+void deviceConnected() {}
+void deviceDisconnected() {}
+
+AMLoopbackTransport loopback;
+AMController amController(&doWork, &doSync, &processIncomingMessages, &processOutgoingMessages, &deviceConnected, &deviceDisconnected);
+
+int main() {
+  amController.setTransport(&loopback);
+  amController.begin();
+
+  // Not a time of the clock started at 1/1/2000 by begin()
+  amController.sdLogMs("V", 1000ULL, 1.0f);
+  amController.sdLogMs("V", 946684800000ULL, 2.0f);
+  CHECK(amController.sdLogPending() == 0);
+
+  // 5 s after begin(), held until the clock is set
+  fakeMillis += 5000;
+  amController.sdLogMs("V", amController.nowMs(), 3.0f);
+  CHECK(amController.sdLogPending() == 1);
+  CHECK(sdFiles["/V"] == "");
+
+  // Time set 10 s after begin(): the held sample is rebased 5 s before it
+  fakeMillis += 5000;
+  loopback.connect();
+  loopback.inject("$Time$=1700000000#");
+  amController.loop();
+  CHECK(amController.sdLogPending() == 0);
+  CHECK_STR(sdFiles["/V"].c_str(), "1699999995;3.00;-;-;-;-\r\n");
+
+  // Written directly from now on
+  amController.sdLogMs("V", amController.nowMs(), 4.0f);
+  CHECK_STR(sdFiles["/V"].c_str(), "1699999995;3.00;-;-;-;-\r\n1700000000;4.00;-;-;-;-\r\n");
+
+  return failures;
+}
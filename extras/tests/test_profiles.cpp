@@ -0,0 +1,50 @@
+/*
+    BLE connection profiles: parameters requested through the fake ArduinoBLE,
+    never changed behind the sketch's back (e.g. by an SD download)
+*/
+#include <string>
+#include "AM_UnoR4Ble.h"
+#include "fakes.h"
+#include "test.h"
+
+void doWork() {}
+void doSync() {}
+void processIncomingMessages(char *variable, char *value) {}
+void processOutgoingMessages() {}
+void deviceConnected() {}
+void deviceDisconnected() {}
+
+AMController amController(&doWork, &doSync, &processIncomingMessages, &processOutgoingMessages, &deviceConnected, &deviceDisconnected);
+
+int main() {
+  amController.begin();
+  CHECK(amController.profile() == PROFILE_INTERACTIVE);
+  CHECK(bleMinInterval == 12 && bleMaxInterval == 24);
+  CHECK(bleSupervisionTimeout == 200);
+
+  amController.setProfile(PROFILE_IDLE);
+  CHECK(amController.profile() == PROFILE_IDLE);
+  CHECK(bleMinInterval == 80 && bleMaxInterval == 160);
+  CHECK(bleSupervisionTimeout == 600);
+
+  amController.setProfile(PROFILE_BULK);
+  CHECK(bleMinInterval == 6 && bleMaxInterval == 12);
+  CHECK(bleSupervisionTimeout == 200);
+
+  // Link parameters are requested when the app connects: a download doesn't touch them
+  amController.setProfile(PROFILE_INTERACTIVE);
+  sdFiles["/LOG.TXT"] = std::string(2000, 'x');
+  amController.connected();
+  amController.loop();
+  const char *download = "$SDDL$=LOG.TXT#";
+  amController.dataAvailable(download, strlen(download));
+  for (int i = 0; i < 200; i++) {
+    amController.loop();
+    CHECK(amController.profile() == PROFILE_INTERACTIVE);
+    CHECK(bleMinInterval == 12 && bleMaxInterval == 24);
+    fakeMillis += 10;
+  }
+  CHECK(amController.bulkThroughput() > 0);
+
+  return failures;
+}
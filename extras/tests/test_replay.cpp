@@ -0,0 +1,124 @@
+// FLAGS: -DAM_WITH_TRACE
+/*
+    Trace replay: received data is delivered on its own timeline and sent data is compared
+    as a byte stream, whatever the packets it is split in
+*/
+#include <string>
+#include "AM_UnoR4Ble.h"
+#include "fakes.h"
+#include "test.h"
+
+class TraceStream : public Stream {
+public:
+  std::string data;
+  size_t position = 0;
+
+  size_t write(uint8_t c) {
+    data += (char)c;
+    return 1;
+  }
+  int available() {
+    return data.size() - position;
+  }
+  int read() {
+    return position < data.size() ? (uint8_t)data[position++] : -1;
+  }
+  int peek() {
+    return position < data.size() ? (uint8_t)data[position] : -1;
+  }
+};
+
+static std::string received;
+
+extern AMController amController;
+
+void doWork() {}
+void doSync() {}
+void processIncomingMessages(char *variable, char *value) {
+  received += std::string(variable) + "=" + value + ";";
+  if (strcmp(variable, "Led") == 0) {
+    amController.writeMessage("Pot", atoi(value));
+  }
+}
+void processOutgoingMessages() {}
+void deviceConnected() {}
+void deviceDisconnected() {}
+
+AMController amController(&doWork, &doSync, &processIncomingMessages, &processOutgoingMessages, &deviceConnected, &deviceDisconnected);
+
+static void replay(AMReplayTransport &transport, unsigned long ms) {
+  for (unsigned long t = 0; t < ms && !transport.finished(); t += 5) {
+    amController.loop();
+    fakeMillis += 5;
+  }
+}
+
+int main() {
+  // Recorded with smaller packets: the same bytes sent in one packet match
+  {
+    TraceStream trace;
+    trace.data = "C0 \nR10 Led=1#\nT5 Pot=\nT0 1#\nR100 Led=2#\nT5 Pot=2#\nD50 \n";
+    AMReplayTransport transport(trace);
+    amController.setTransport(&transport);
+    amController.begin();
+    replay(transport, 2000);
+    CHECK(transport.finished());
+    CHECK(received == "Led=1;Led=2;");
+    CHECK(transport.matched() == 3);
+    CHECK(transport.mismatched() == 0);
+    CHECK(transport.missed() == 0);
+    CHECK(transport.unexpected() == 0);
+  }
+
+  // Packets never sent do not hold back the received data: they are skipped when a later one is sent
+  // or missed after the timeout
+  {
+    TraceStream trace;
+    trace.data = "C0 \nT10 Extra=9#\nR10 Led=3#\nT5 Pot=3#\nR10 Led=4#\nT5 Pot=5#\nT10 Late=1#\nD10 \n";
+    AMReplayTransport transport(trace, 20, 500);
+    received = "";
+    amController.setTransport(&transport);
+    amController.begin();
+    replay(transport, 200);
+    CHECK(received == "Led=3;Led=4;");
+    CHECK(!transport.finished());
+    replay(transport, 2000);
+    CHECK(transport.finished());
+    CHECK(transport.matched() == 1);
+    CHECK(transport.mismatched() == 1);
+    CHECK(transport.missed() == 2);
+    CHECK(transport.unexpected() == 0);
+  }
+
+  // Recording and replay of the same session
+  {
+    TraceStream recording;
+    AMLoopbackTransport loopback;
+    received = "";
+    amController.setTransport(&loopback);
+    amController.begin();
+    amController.traceBegin(&recording);
+    loopback.connect();
+    for (int i = 0; i < 20; i++) {
+      char message[16];
+      snprintf(message, sizeof(message), "Led=%d#", i);
+      loopback.inject(message);
+      amController.loop();
+      fakeMillis += 37;
+    }
+    loopback.disconnect();
+    amController.loop();
+    amController.traceEnd();
+
+    AMReplayTransport transport(recording);
+    received = "";
+    amController.setTransport(&transport);
+    amController.begin();
+    replay(transport, 5000);
+    CHECK(transport.finished());
+    CHECK(transport.matched() == 20);
+    CHECK(transport.mismatched() + transport.missed() + transport.unexpected() == 0);
+  }
+
+  return failures;
+}
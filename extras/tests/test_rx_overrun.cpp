@@ -0,0 +1,69 @@
+/*
+    Receive buffer overruns: writes are dropped whole, the parser resumes at the next
+    message boundary and never joins data across the gap
+*/
+#include <string>
+#include "AM_UnoR4Ble.h"
+#include "fakes.h"
+#include "test.h"
+
+std::string received;
+
+void doWork() {}
+void doSync() {}
+void processIncomingMessages(char *variable, char *value) {
+  received += std::string(variable) + "=" + value + ";";
+}
+void processOutgoingMessages() {}
+void deviceConnected() {}
+void deviceDisconnected() {}
+
+AMLoopbackTransport loopback;
+AMController amController(&doWork, &doSync, &processIncomingMessages, &processOutgoingMessages, &deviceConnected, &deviceDisconnected);
+
+// Fills the receive buffer with complete messages, without parsing them, up to room bytes left
+std::string fill(size_t room = 0) {
+  std::string expected;
+  while (amController.rxSpace() >= room + 4) {
+    amController.dataAvailable("A=1#", 4);
+    expected += "A=1;";
+  }
+  return expected;
+}
+
+int main() {
+  amController.setTransport(&loopback);
+  amController.begin();
+  loopback.connect();
+  amController.loop();
+
+  // Dropped write ending on a boundary, right after a complete message: nothing else is lost
+  received = "";
+  std::string expected = fill();
+  unsigned long overruns = amController.rxOverruns();
+  amController.dataAvailable("Knob1=77777777777#", 18);
+  amController.loop();
+  loopback.inject("Push1=1#");
+  CHECK_STR(received.c_str(), (expected + "Push1=1;").c_str());
+  CHECK(amController.rxOverruns() - overruns == 18);
+
+  // Message in progress when the buffer overflows: it is discarded, the next one is intact
+  received = "";
+  expected = fill(10);
+  amController.dataAvailable("Slider1=0.", 10);
+  amController.dataAvailable("5#Knob1=3#", 10);
+  amController.dataAvailable("Knob2=4#", 8);  // Dropped too, it would be joined across the gap
+  amController.loop();
+  loopback.inject("Push1=1#");
+  CHECK_STR(received.c_str(), (expected + "Push1=1;").c_str());
+
+  // Dropped write ending inside a message: its end is discarded up to #
+  received = "";
+  expected = fill();
+  amController.dataAvailable("Knob1=7777777777", 16);
+  amController.loop();
+  loopback.inject("7#Push1=1#");
+  CHECK_STR(received.c_str(), (expected + "Push1=1;").c_str());
+
+  return failures;
+}
@@ -0,0 +1,78 @@
+/*
+    AMTopic messages: same text as the printf based writeMessage() and conflation
+    registered after the first message
+*/
+#include <random>
+#include <string>
+#include "AM_UnoR4Ble.h"
+#include "fakes.h"
+#include "test.h"
+
+void doWork() {}
+void doSync() {}
+void processIncomingMessages(char *variable, char *value) {}
+void processOutgoingMessages() {}
+void deviceConnected() {}
+void deviceDisconnected() {}
+
+AMLoopbackTransport loopback;
+AMController amController(&doWork, &doSync, &processIncomingMessages, &processOutgoingMessages, &deviceConnected, &deviceDisconnected);
+
+int main() {
+  amController.setTransport(&loopback);
+  amController.begin();
+  loopback.connect();
+
+  // Floats of any magnitude, the fixed point encoder has to match %.5f, ties included
+  AMTopic value("Value");
+  std::mt19937 random(1);
+  unsigned long different = 0;
+  for (int i = 0; i < 200000; i++) {
+    float v;
+    if (i % 4 == 0) {
+      v = (float)(int)(random() % 2000000 - 1000000) / 64;  // Exact binary fractions, ties at the 5th decimal
+    } else {
+      uint32_t bits = random();
+      memcpy(&v, &bits, sizeof(v));
+      if (isnan(v) || isinf(v))
+        continue;
+    }
+
+    char expected[80];
+    snprintf(expected, sizeof(expected), "Value=%.5f#", v);
+    loopback.clear();
+    amController.writeMessage(value, v);
+    amController.loop();
+    if (strcmp(loopback.sent(), expected) != 0 && different++ < 5)
+      printf("  %s != %s\n", loopback.sent(), expected);
+  }
+  CHECK(different == 0);
+
+  AMTopic count("Count");
+  const int ints[] = { 0, 1, -1, 42, -32768, 2147483647, -2147483647 - 1 };
+  for (int v : ints) {
+    char expected[32];
+    snprintf(expected, sizeof(expected), "Count=%d#", v);
+    loopback.clear();
+    amController.writeMessage(count, v);
+    amController.loop();
+    CHECK_STR(loopback.sent(), expected);
+  }
+
+  // Conflation registered after the topic was first written
+  AMTopic level("Level");
+  loopback.clear();
+  amController.writeMessage(level, 1);
+  amController.writeMessage(level, 2);
+  amController.loop();
+  CHECK_STR(loopback.sent(), "Level=1#Level=2#");
+
+  amController.conflateVariable("Level");
+  loopback.clear();
+  amController.writeMessage(level, 3);
+  amController.writeMessage(level, 4);
+  amController.loop();
+  CHECK_STR(loopback.sent(), "Level=4#");
+
+  return failures;
+}
@@ -0,0 +1,96 @@
+/*
+ *
+ * AMController libraries, example sketches (“The Software”) and the related documentation (“The Documentation”) are supplied to you
+ * by the Author in consideration of your agreement to the following terms, and your use or installation of The Software and the use of The Documentation
+ * constitutes acceptance of these terms.
+ * If you do not agree with these terms, please do not use or install The Software.
+ * The Author grants you a personal, non-exclusive license, under author's copyrights in this original software, to use The Software.
+ * Except as expressly stated in this notice, no other rights or licenses, express or implied, are granted by the Author, including but not limited to any
+ * patent rights that may be infringed by your derivative works or by other works in which The Software may be incorporated.
+ * The Software and the Documentation are provided by the Author on an "AS IS" basis.  THE AUTHOR MAKES NO WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT
+ * LIMITATION THE IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, REGARDING THE SOFTWARE OR ITS USE AND OPERATION
+ * ALONE OR IN COMBINATION WITH YOUR PRODUCTS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF THE USE,
+ * REPRODUCTION AND MODIFICATION OF THE SOFTWARE AND OR OF THE DOCUMENTATION, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT (INCLUDING NEGLIGENCE),
+ * STRICT LIABILITY OR OTHERWISE, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+   Author: Fabrizio Boco - fabboco@gmail.com
+
+   All rights reserved
+
+*/
+#include "AM_Compressor.h"
+
+#define HASH(p) ((uint8_t)(((p)[0] << 5) ^ ((p)[1] << 2) ^ (p)[2] ^ ((p)[0] >> 3)))
+
+void AMCompressor::begin() {
+  memset(_head, 0, sizeof(_head));
+  _position = 0;
+}
+
+// Byte at an absolute position: from the history or, if not yet compressed, from the input
+uint8_t AMCompressor::byteAt(uint32_t position, const uint8_t *in, size_t i) {
+  if (position < _position) {
+    return _window[position & (COMPRESSION_WINDOW - 1)];
+  }
+  return in[i + (position - _position)];
+}
+
+void AMCompressor::push(const uint8_t *in, size_t i) {
+  _window[_position & (COMPRESSION_WINDOW - 1)] = in[i];
+  _position++;
+}
+
+size_t AMCompressor::compress(const uint8_t *in, size_t l, uint8_t *out) {
+  size_t o = 0;
+  size_t flag = 0;
+  uint8_t bit = 8;
+  size_t i = 0;
+
+  while (i < l) {
+
+    if (bit == 8) {
+      flag = o++;
+      out[flag] = 0;
+      bit = 0;
+    }
+
+    uint8_t length = 0;
+    uint16_t distance = 0;
+
+    if (l - i >= COMPRESSION_MIN_MATCH) {
+      uint8_t h = HASH(&in[i]);
+
+      distance = (uint16_t)_position - _head[h];
+      _head[h] = (uint16_t)_position;
+
+      // Candidates are always verified, so stale hash entries are harmless
+      if (distance > 0 && distance < COMPRESSION_WINDOW && distance <= _position) {
+        uint8_t maxLength = min(l - i, (size_t)COMPRESSION_MAX_MATCH);
+        while (length < maxLength && byteAt(_position - distance + length, in, i) == in[i + length]) {
+          length++;
+        }
+      }
+    }
+
+    if (length >= COMPRESSION_MIN_MATCH) {
+      out[o++] = distance & 0xFF;
+      out[o++] = ((distance >> 8) << 4) | (length - COMPRESSION_MIN_MATCH);
+
+      for (uint8_t k = 0; k < length; k++) {
+        if (k > 0 && l - i >= COMPRESSION_MIN_MATCH) {
+          _head[HASH(&in[i])] = (uint16_t)_position;
+        }
+        push(in, i++);
+      }
+    } else {
+      out[flag] |= 1 << bit;
+      out[o++] = in[i];
+      push(in, i++);
+    }
+
+    bit++;
+  }
+
+  return o;
+}
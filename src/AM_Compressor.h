@@ -0,0 +1,72 @@
+/*
+   AMController libraries, example sketches (“The Software”) and the related documentation (“The Documentation”) are supplied to you
+   by the Author in consideration of your agreement to the following terms, and your use or installation of The Software and the use of The Documentation
+   constitutes acceptance of these terms.
+   If you do not agree with these terms, please do not use or install The Software.
+   The Author grants you a personal, non-exclusive license, under author's copyrights in this original software, to use The Software.
+   Except as expressly stated in this notice, no other rights or licenses, express or implied, are granted by the Author, including but not limited to any
+   patent rights that may be infringed by your derivative works or by other works in which The Software may be incorporated.
+   The Software and the Documentation are provided by the Author on an "AS IS" basis.  THE AUTHOR MAKES NO WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT
+   LIMITATION THE IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, REGARDING THE SOFTWARE OR ITS USE AND OPERATION
+   ALONE OR IN COMBINATION WITH YOUR PRODUCTS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES (INCLUDING,
+   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF THE USE,
+   REPRODUCTION AND MODIFICATION OF THE SOFTWARE AND OR OF THE DOCUMENTATION, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT (INCLUDING NEGLIGENCE),
+   STRICT LIABILITY OR OTHERWISE, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+   Author: Fabrizio Boco - fabboco@gmail.com
+
+   All rights reserved
+
+*/
+#ifndef AM_Compressor_H
+#define AM_Compressor_H
+
+#include <Arduino.h>
+
+#define COMPRESSION_WINDOW 1024  // History [bytes], power of 2 not greater than 4096
+#define COMPRESSION_HASH 256
+#define COMPRESSION_MIN_MATCH 3
+#define COMPRESSION_MAX_MATCH 18
+
+/*
+    Streaming LZSS compressor
+
+    Wire format, sent to the app in <var>=$Z$<n>:<n bytes># frames (one compress() call each):
+
+    - groups of a flag byte followed by up to 8 items. Bit i of the flag (LSB first) describes item i
+    - bit 1, literal: one byte, copied as is
+    - bit 0, match: two bytes b0 b1
+        distance = b0 | ((b1 >> 4) << 8)   12 bits, 1 to COMPRESSION_WINDOW - 1
+        length = (b1 & 0x0F) + 3           4 bits, 3 to 18
+      length bytes copied one at a time from distance bytes back in the decoded stream,
+      so a match can overlap the bytes it produces (distance < length)
+
+    The last group of a frame can be shorter than 8 items, the next frame starts with a new flag byte.
+    Matches can refer to the data of previous frames of the same transfer: the decoder keeps the last
+    COMPRESSION_WINDOW decoded bytes until the transfer ends (begin() is called for each transfer).
+    A frame is never longer than l + (l + 7) / 8 bytes for l bytes of input.
+    extras/tests/test_compressor.cpp has a reference decoder
+*/
+class AMCompressor {
+
+private:
+
+  uint8_t _window[COMPRESSION_WINDOW];
+  uint16_t _head[COMPRESSION_HASH];  // Last position of each hash
+  uint32_t _position;                // Bytes compressed since begin()
+
+  uint8_t byteAt(uint32_t position, const uint8_t *in, size_t i);
+  void push(const uint8_t *in, size_t i);
+
+public:
+
+  void begin();
+
+  /*
+      Compresses l bytes of in into out, which has to be at least l + (l + 7) / 8 bytes long.
+      Returns the number of bytes written in out
+    */
+  size_t compress(const uint8_t *in, size_t l, uint8_t *out);
+};
+
+#endif
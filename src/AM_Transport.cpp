@@ -0,0 +1,546 @@
+/*
+ *
+ * AMController libraries, example sketches (“The Software”) and the related documentation (“The Documentation”) are supplied to you
+ * by the Author in consideration of your agreement to the following terms, and your use or installation of The Software and the use of The Documentation
+ * constitutes acceptance of these terms.
+ * If you do not agree with these terms, please do not use or install The Software.
+ * The Author grants you a personal, non-exclusive license, under author's copyrights in this original software, to use The Software.
+ * Except as expressly stated in this notice, no other rights or licenses, express or implied, are granted by the Author, including but not limited to any
+ * patent rights that may be infringed by your derivative works or by other works in which The Software may be incorporated.
+ * The Software and the Documentation are provided by the Author on an "AS IS" basis.  THE AUTHOR MAKES NO WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT
+ * LIMITATION THE IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, REGARDING THE SOFTWARE OR ITS USE AND OPERATION
+ * ALONE OR IN COMBINATION WITH YOUR PRODUCTS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF THE USE,
+ * REPRODUCTION AND MODIFICATION OF THE SOFTWARE AND OR OF THE DOCUMENTATION, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT (INCLUDING NEGLIGENCE),
+ * STRICT LIABILITY OR OTHERWISE, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+   Author: Fabrizio Boco - fabboco@gmail.com
+
+   All rights reserved
+
+*/
+#include "AM_UnoR4Ble.h"
+
+////////////////////////////////////////////////////
+// BLE
+
+static AMController *bleController;
+
+bool AMBleTransport::begin(AMController *controller) {
+
+  _controller = controller;
+  bleController = controller;
+
+  if (!BLE.begin()) {
+    return false;
+  }
+
+  // set the local name peripheral advertises
+  BLE.setLocalName("AManager");
+  BLE.setDeviceName("AManager");
+  BLE.setAdvertisedService(mainService);
+
+  // add the characteristic to the service
+  mainService.addCharacteristic(rxCharacteristic);
+  mainService.addCharacteristic(txCharacteristic);
+
+  BLE.addService(mainService);
+
+  batteryService.addCharacteristic(batteryLevelCharacteristic);
+  BLE.addService(batteryService);
+
+  // assign event handlers for connected, disconnected to peripheral
+  BLE.setEventHandler(BLEConnected, connectHandler);
+  BLE.setEventHandler(BLEDisconnected, disconnectHandler);
+  rxCharacteristic.setEventHandler(BLEWritten, characteristicWritten);
+
+  // start advertising
+  BLE.advertise();
+
+  return true;
+}
+
+void AMBleTransport::poll() {
+  BLE.poll();
+}
+
+void AMBleTransport::write(const uint8_t *buffer, uint8_t l) {
+  uint8_t buffer1[22];
+
+  memset(&buffer1, '\0', 22);
+  memcpy(&buffer1, buffer, l);
+
+  //PRINT("Sending >"); PRINT((char *)buffer1); PRINT("<"); PRINTLN();
+
+  txCharacteristic.writeValue((uint8_t *)&buffer1, 20);
+  delay(WRITE_DELAY);
+  BLE.poll();
+}
+
+uint8_t AMBleTransport::packetSize() {
+  return 20;
+}
+
+bool AMBleTransport::ready() {
+  return txCharacteristic.subscribed();
+}
+
+unsigned long AMBleTransport::messageDelay() {
+  return WRITE_DELAY;
+}
+
+void AMBleTransport::updateBatteryLevel(uint8_t level) {
+  batteryLevelCharacteristic.writeValue(level);
+  delay(WRITE_DELAY);
+}
+
+// Connection interval in units of 1.25 ms, supervision timeout in units of 10 ms.
+// ArduinoBLE asks the central for them with a connection parameter update request when the central connects,
+// it has no way to change them on a live connection. Slave latency is always 0
+void AMBleTransport::setProfile(AMProfile profile) {
+  switch (profile) {
+    case PROFILE_INTERACTIVE:
+      BLE.setConnectionInterval(12, 24);  // 15 - 30 ms
+      BLE.setSupervisionTimeout(200);     // 2 s
+      break;
+    case PROFILE_BULK:
+      BLE.setConnectionInterval(6, 12);  // 7.5 - 15 ms
+      BLE.setSupervisionTimeout(200);    // 2 s
+      break;
+    case PROFILE_IDLE:
+      BLE.setConnectionInterval(80, 160);  // 100 - 200 ms
+      BLE.setSupervisionTimeout(600);      // 6 s, at least 6 intervals
+      break;
+  }
+}
+
+void AMBleTransport::connectHandler(BLEDevice central) {
+  // central connected event handler
+  bleController->connected();
+  PRINT("\tConnected event, central: ");
+  PRINTLN(central.address());
+}
+
+void AMBleTransport::disconnectHandler(BLEDevice central) {
+  // central disconnected event handler
+  bleController->disconnected();
+  PRINT("\tDisconnected event, central: ");
+  PRINTLN(central.address());
+}
+
+// Writes with or without response, several of them can arrive in the same connection event.
+// Data is only appended to the receive buffer and parsed in one pass from loop()
+void AMBleTransport::characteristicWritten(BLEDevice central, BLECharacteristic characteristic) {
+
+  //PRINTLN("Characteristic event, written: ");
+
+  char buffer[40];
+  int n = characteristic.readValue(buffer, sizeof(buffer) - 1);
+  buffer[n] = '\0';
+
+  PRINT("R >");
+  PRINT(buffer);
+  PRINT("< ");
+  PRINTLN(n);
+
+  bleController->dataAvailable(buffer, strlen(buffer));
+}
+
+////////////////////////////////////////////////////
+// Serial
+
+AMSerialTransport::AMSerialTransport(Stream &stream)
+  : _stream(stream) {
+  _connected = false;
+}
+
+bool AMSerialTransport::begin(AMController *controller) {
+  _controller = controller;
+  _connected = false;
+  return true;
+}
+
+void AMSerialTransport::poll() {
+  char buffer[21];
+
+  uint8_t n = min((size_t)_stream.available(), min(sizeof(buffer) - 1, _controller->rxSpace()));
+  if (n == 0) {
+    return;
+  }
+
+  n = _stream.readBytes(buffer, n);
+  buffer[n] = '\0';
+
+  if (!_connected) {
+    _connected = true;
+    _controller->connected();
+  }
+
+  _controller->dataAvailable(buffer, n);
+}
+
+void AMSerialTransport::write(const uint8_t *buffer, uint8_t l) {
+  _stream.write(buffer, l);
+}
+
+uint8_t AMSerialTransport::packetSize() {
+  return 64;
+}
+
+////////////////////////////////////////////////////
+// TCP
+
+#if defined(TCP_TRANSPORT_SUPPORT)
+
+AMTcpTransport::AMTcpTransport(uint16_t port)
+  : _server(port) {
+  _connected = false;
+}
+
+bool AMTcpTransport::begin(AMController *controller) {
+  _controller = controller;
+  _server.begin();
+  return true;
+}
+
+void AMTcpTransport::poll() {
+  char buffer[21];
+
+  if (!_connected) {
+    _client = _server.available();
+    if (!_client) {
+      return;
+    }
+    _connected = true;
+    _controller->connected();
+  }
+
+  if (!_client.connected()) {
+    _client.stop();
+    _connected = false;
+    _controller->disconnected();
+    return;
+  }
+
+  uint8_t n = min((size_t)_client.available(), min(sizeof(buffer) - 1, _controller->rxSpace()));
+  if (n == 0) {
+    return;
+  }
+
+  n = _client.read((uint8_t *)buffer, n);
+  buffer[n] = '\0';
+
+  _controller->dataAvailable(buffer, n);
+}
+
+void AMTcpTransport::write(const uint8_t *buffer, uint8_t l) {
+  if (_connected) {
+    _client.write(buffer, l);
+  }
+}
+
+uint8_t AMTcpTransport::packetSize() {
+  return 128;
+}
+
+#endif
+
+////////////////////////////////////////////////////
+// Loopback
+
+bool AMLoopbackTransport::begin(AMController *controller) {
+  _controller = controller;
+  clear();
+  return true;
+}
+
+void AMLoopbackTransport::poll() {
+}
+
+void AMLoopbackTransport::write(const uint8_t *buffer, uint8_t l) {
+  uint16_t n = min((uint16_t)l, (uint16_t)(LOOPBACK_BUFFER_SIZE - _sentLength));
+
+  memcpy(&_sent[_sentLength], buffer, n);
+  _sentLength += n;
+  _sent[_sentLength] = '\0';
+  _packets++;
+}
+
+// Same packet size of BLE, so that benchmarks are representative
+uint8_t AMLoopbackTransport::packetSize() {
+  return 20;
+}
+
+void AMLoopbackTransport::connect() {
+  _controller->connected();
+}
+
+void AMLoopbackTransport::disconnect() {
+  _controller->disconnected();
+}
+
+// Data is delivered in packets of the same size of BLE writes
+void AMLoopbackTransport::inject(const char *data) {
+  size_t l = strlen(data);
+
+  while (l > 0) {
+    uint8_t n = min(l, min((size_t)20, _controller->rxSpace()));
+    if (n == 0) {
+      break;
+    }
+    _controller->dataAvailable(data, n);
+    _controller->processIncomingData();
+    data += n;
+    l -= n;
+  }
+}
+
+const char *AMLoopbackTransport::sent() {
+  return (const char *)_sent;
+}
+
+uint16_t AMLoopbackTransport::sentLength() {
+  return _sentLength;
+}
+
+unsigned long AMLoopbackTransport::sentPackets() {
+  return _packets;
+}
+
+void AMLoopbackTransport::clear() {
+  _sentLength = 0;
+  _sent[0] = '\0';
+  _packets = 0;
+}
+
+////////////////////////////////////////////////////
+// Trace replay
+
+#if defined(TRACE_SUPPORT)
+
+AMReplayTransport::AMReplayTransport(Stream &trace, uint8_t packetSize, unsigned long timeout)
+  : _trace(trace) {
+  _packetSize = packetSize;
+  _timeout = timeout;
+}
+
+bool AMReplayTransport::begin(AMController *controller) {
+  _controller = controller;
+  _pending = false;
+  _at = 0;
+  _start = millis();
+  _expectedFirst = 0;
+  _expectedCount = 0;
+  _packetsFirst = 0;
+  _packetsCount = 0;
+  _matched = 0;
+  _mismatched = 0;
+  _missed = 0;
+  _unexpected = 0;
+  _lag = 0;
+  return true;
+}
+
+// Trace line: <type><delta ms> <payload>, non printable bytes as \xHH
+bool AMReplayTransport::readEvent() {
+  char c = '\0';
+  uint8_t n = 0;
+
+  if (!_trace.available()) {
+    return false;
+  }
+
+  _type = _trace.read();
+
+  unsigned long delta = 0;
+  while (_trace.available() && (c = _trace.read()) != ' ' && c != '\n') {
+    delta = delta * 10 + (c - '0');
+  }
+  _at += delta;
+
+  while (c != '\n' && _trace.available() && (c = _trace.read()) != '\n') {
+    if (c == '\\') {
+      char hex[3];
+      _trace.read();  // x
+      hex[0] = _trace.read();
+      hex[1] = _trace.read();
+      hex[2] = '\0';
+      c = strtol(hex, NULL, 16);
+    }
+    if (n < TRACE_LINE_SIZE)
+      _line[n++] = c;
+  }
+  _line[n] = '\0';
+  _length = n;
+  _pending = true;
+
+  return true;
+}
+
+// Recorded packet appended to the bytes AMController is expected to send,
+// the oldest ones are given up when there is no room
+void AMReplayTransport::expect() {
+
+  _pending = false;
+  if (_length == 0) {
+    return;
+  }
+
+  while (_packetsCount == REPLAY_EVENTS || REPLAY_BUFFER_SIZE - _expectedCount < _length) {
+    dropPacket();
+  }
+
+  expectedPacket *p = &_packets[(_packetsFirst + _packetsCount++) % REPLAY_EVENTS];
+  p->at = _at;
+  p->length = _length;
+  p->started = false;
+  p->differs = false;
+
+  for (uint8_t i = 0; i < _length; i++) {
+    _expected[(_expectedFirst + _expectedCount++) % REPLAY_BUFFER_SIZE] = _line[i];
+  }
+}
+
+void AMReplayTransport::dropPacket() {
+  expectedPacket *p = &_packets[_packetsFirst];
+
+  _missed++;
+  _expectedFirst = (_expectedFirst + p->length) % REPLAY_BUFFER_SIZE;
+  _expectedCount -= p->length;
+  _packetsFirst = (_packetsFirst + 1) % REPLAY_EVENTS;
+  _packetsCount--;
+}
+
+void AMReplayTransport::expire() {
+  unsigned long now = millis() - _start;
+
+  while (_packetsCount > 0 && now > _packets[_packetsFirst].at + _timeout) {
+    dropPacket();
+  }
+}
+
+// Sent data different from the next recorded packet: the packets before the first one that
+// begins with it have not been sent by this build
+void AMReplayTransport::resync(const uint8_t *buffer, uint8_t l) {
+  uint16_t offset = 0;
+
+  for (uint8_t k = 0; k < _packetsCount; k++) {
+    expectedPacket *p = &_packets[(_packetsFirst + k) % REPLAY_EVENTS];
+    uint8_t n = min(l, p->length);
+    uint8_t i = 0;
+
+    while (i < n && _expected[(_expectedFirst + offset + i) % REPLAY_BUFFER_SIZE] == buffer[i]) {
+      i++;
+    }
+    if (i == n) {
+      while (k-- > 0) {
+        dropPacket();
+      }
+      return;
+    }
+    offset += p->length;
+  }
+}
+
+// Sent packets never hold back received data and connection events:
+// recorded ones are moved to the expected bytes as soon as they are read
+void AMReplayTransport::poll() {
+
+  expire();
+
+  while (_pending || readEvent()) {
+    if (_type == 'T') {
+      expect();
+      continue;
+    }
+
+    if (millis() - _start < _at) {
+      // Not yet due
+      return;
+    }
+
+    _pending = false;
+
+    switch (_type) {
+      case 'C':
+        _controller->connected();
+        break;
+      case 'D':
+        _controller->disconnected();
+        break;
+      case 'R':
+        _controller->dataAvailable(_line, _length);
+        break;
+    }
+    return;
+  }
+}
+
+void AMReplayTransport::write(const uint8_t *buffer, uint8_t l) {
+
+  // Recorded packets already due, not yet read because poll() was not called in the meantime
+  while ((_pending || readEvent()) && _type == 'T') {
+    expect();
+  }
+  expire();
+
+  for (uint8_t i = 0; i < l; i++) {
+    if (_packetsCount == 0) {
+      _unexpected++;
+      continue;
+    }
+
+    if (!_packets[_packetsFirst].started && _expected[_expectedFirst] != buffer[i]) {
+      resync(&buffer[i], l - i);
+    }
+
+    expectedPacket *p = &_packets[_packetsFirst];
+    p->started = true;
+    if (_expected[_expectedFirst] != buffer[i]) {
+      p->differs = true;
+    }
+    _expectedFirst = (_expectedFirst + 1) % REPLAY_BUFFER_SIZE;
+    _expectedCount--;
+
+    if (--p->length == 0) {
+      if (p->differs) {
+        _mismatched++;
+      } else {
+        _matched++;
+      }
+      _lag += (long)(millis() - _start) - (long)p->at;
+      _packetsFirst = (_packetsFirst + 1) % REPLAY_EVENTS;
+      _packetsCount--;
+    }
+  }
+}
+
+uint8_t AMReplayTransport::packetSize() {
+  return _packetSize;
+}
+
+bool AMReplayTransport::finished() {
+  return !_pending && !_trace.available() && _packetsCount == 0;
+}
+
+unsigned long AMReplayTransport::matched() {
+  return _matched;
+}
+
+unsigned long AMReplayTransport::mismatched() {
+  return _mismatched;
+}
+
+unsigned long AMReplayTransport::missed() {
+  return _missed;
+}
+
+unsigned long AMReplayTransport::unexpected() {
+  return _unexpected;
+}
+
+long AMReplayTransport::lag() {
+  return _lag;
+}
+
+#endif
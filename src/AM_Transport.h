@@ -0,0 +1,284 @@
+/*
+   AMController libraries, example sketches (“The Software”) and the related documentation (“The Documentation”) are supplied to you
+   by the Author in consideration of your agreement to the following terms, and your use or installation of The Software and the use of The Documentation
+   constitutes acceptance of these terms.
+   If you do not agree with these terms, please do not use or install The Software.
+   The Author grants you a personal, non-exclusive license, under author's copyrights in this original software, to use The Software.
+   Except as expressly stated in this notice, no other rights or licenses, express or implied, are granted by the Author, including but not limited to any
+   patent rights that may be infringed by your derivative works or by other works in which The Software may be incorporated.
+   The Software and the Documentation are provided by the Author on an "AS IS" basis.  THE AUTHOR MAKES NO WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT
+   LIMITATION THE IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, REGARDING THE SOFTWARE OR ITS USE AND OPERATION
+   ALONE OR IN COMBINATION WITH YOUR PRODUCTS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES (INCLUDING,
+   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF THE USE,
+   REPRODUCTION AND MODIFICATION OF THE SOFTWARE AND OR OF THE DOCUMENTATION, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT (INCLUDING NEGLIGENCE),
+   STRICT LIABILITY OR OTHERWISE, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+   Author: Fabrizio Boco - fabboco@gmail.com
+
+   All rights reserved
+
+*/
+#ifndef AM_Transport_H
+#define AM_Transport_H
+
+#include <Arduino.h>
+#include <ArduinoBLE.h>
+
+#if defined(TCP_TRANSPORT_SUPPORT)
+#include <WiFiS3.h>
+#endif
+
+class AMController;
+
+typedef enum {
+  PROFILE_INTERACTIVE,  // Short connection interval, controls react quickly (default)
+  PROFILE_BULK,         // Shortest connection interval, more packets per second (e.g. sketches mainly downloading logs)
+  PROFILE_IDLE          // Long connection interval, lower power when the app only watches slow values
+} AMProfile;
+
+/*
+    Link used by AMController to exchange var=value# messages with the app
+
+    A transport delivers incoming bytes with AMController::dataAvailable() and
+    reports connections with AMController::connected() / disconnected()
+*/
+class AMTransport {
+
+public:
+
+  virtual ~AMTransport() {}
+
+  /*
+      Starts the transport. Returns false if the underlying hardware cannot be started
+    */
+  virtual bool begin(AMController *controller) = 0;
+
+  /*
+      Services the link. Called frequently from AMController::loop()
+    */
+  virtual void poll() = 0;
+
+  /*
+      Sends a single packet. l is never greater than packetSize()
+    */
+  virtual void write(const uint8_t *buffer, uint8_t l) = 0;
+
+  /*
+      Maximum number of bytes sent with a single write()
+    */
+  virtual uint8_t packetSize() = 0;
+
+  /*
+      True when the peer can receive data (e.g. BLE notifications enabled)
+    */
+  virtual bool ready() {
+    return true;
+  }
+
+  /*
+      Delay [ms] to be observed after each message
+    */
+  virtual unsigned long messageDelay() {
+    return 0;
+  }
+
+  virtual void updateBatteryLevel(uint8_t level) {}
+
+  /*
+      Requests the link parameters suitable for profile, for the next connection
+    */
+  virtual void setProfile(AMProfile profile) {}
+
+protected:
+
+  AMController *_controller = NULL;
+};
+
+/*
+    Bluetooth® Low Energy transport (default)
+*/
+class AMBleTransport : public AMTransport {
+
+private:
+
+  BLEService mainService = BLEService("19B10000-E8F2-537E-4F6C-D104768A1214");  // create service
+  BLECharacteristic rxCharacteristic = BLECharacteristic("19B10001-E8F2-537E-4F6C-D104768A1214", BLEWrite | BLEWriteWithoutResponse | BLENotify, 20, (1 == 1));
+  BLECharacteristic txCharacteristic = BLECharacteristic("19B10002-E8F2-537E-4F6C-D104768A1214", BLERead | BLENotify, 20, (1 == 1));
+
+  BLEService batteryService = BLEService("180F");
+  BLEUnsignedCharCharacteristic batteryLevelCharacteristic = BLEUnsignedCharCharacteristic("2A19", BLERead | BLENotify);
+
+  static void connectHandler(BLEDevice central);
+  static void disconnectHandler(BLEDevice central);
+  static void characteristicWritten(BLEDevice central, BLECharacteristic characteristic);
+
+public:
+
+  bool begin(AMController *controller);
+  void poll();
+  void write(const uint8_t *buffer, uint8_t l);
+  uint8_t packetSize();
+  bool ready();
+  unsigned long messageDelay();
+  void updateBatteryLevel(uint8_t level);
+  void setProfile(AMProfile profile);
+};
+
+/*
+    Transport over any Stream (e.g. the USB Serial port)
+
+    The link is considered connected as soon as the first byte is received
+*/
+class AMSerialTransport : public AMTransport {
+
+private:
+
+  Stream &_stream;
+  bool _connected;
+
+public:
+
+  AMSerialTransport(Stream &stream);
+
+  bool begin(AMController *controller);
+  void poll();
+  void write(const uint8_t *buffer, uint8_t l);
+  uint8_t packetSize();
+};
+
+#if defined(TCP_TRANSPORT_SUPPORT)
+
+/*
+    TCP transport over the WiFi module
+
+    WiFi has to be connected by the sketch before calling AMController::begin()
+*/
+class AMTcpTransport : public AMTransport {
+
+private:
+
+  WiFiServer _server;
+  WiFiClient _client;
+  bool _connected;
+
+public:
+
+  AMTcpTransport(uint16_t port);
+
+  bool begin(AMController *controller);
+  void poll();
+  void write(const uint8_t *buffer, uint8_t l);
+  uint8_t packetSize();
+};
+
+#endif
+
+#define LOOPBACK_BUFFER_SIZE 256
+
+/*
+    In memory transport, useful to benchmark the library without any radio
+
+    Data passed to inject() is delivered to AMController as if it was received from the app,
+    data sent by AMController is kept in a buffer readable with sent()
+*/
+class AMLoopbackTransport : public AMTransport {
+
+private:
+
+  uint8_t _sent[LOOPBACK_BUFFER_SIZE + 1];
+  uint16_t _sentLength;
+  unsigned long _packets;
+
+public:
+
+  bool begin(AMController *controller);
+  void poll();
+  void write(const uint8_t *buffer, uint8_t l);
+  uint8_t packetSize();
+
+  void connect();
+  void disconnect();
+  void inject(const char *data);
+
+  const char *sent();
+  uint16_t sentLength();
+  unsigned long sentPackets();
+  void clear();
+};
+
+#if defined(TRACE_SUPPORT)
+
+#define TRACE_LINE_SIZE 140
+#define REPLAY_BUFFER_SIZE 256  // Recorded bytes not yet sent by AMController
+#define REPLAY_EVENTS 16        // Recorded packets not yet sent by AMController
+
+/*
+    Replays a trace recorded with AMController::traceBegin()
+
+    Received data and connection events are delivered with the same timing of the recording.
+    Data sent by AMController is compared with the recorded one as a byte stream, independently of
+    how it is split in packets: a recorded packet matches when all its bytes are sent within timeout ms
+    of the time it was recorded at, otherwise it is missed and skipped. Recorded packets are skipped
+    as well when the data sent matches a later one.
+    Works with a trace on SD or any other Stream, without any radio
+*/
+class AMReplayTransport : public AMTransport {
+
+private:
+
+  struct expectedPacket {
+    unsigned long at;
+    uint8_t length;   // Bytes not sent yet
+    bool started;
+    bool differs;
+  };
+
+  Stream &_trace;
+  uint8_t _packetSize;
+  unsigned long _timeout;
+  char _line[TRACE_LINE_SIZE + 1];
+  char _type;
+  uint8_t _length;
+  bool _pending;
+  unsigned long _at;
+  unsigned long _start;
+
+  uint8_t _expected[REPLAY_BUFFER_SIZE];
+  uint16_t _expectedFirst;
+  uint16_t _expectedCount;
+  expectedPacket _packets[REPLAY_EVENTS];
+  uint8_t _packetsFirst;
+  uint8_t _packetsCount;
+
+  unsigned long _matched;
+  unsigned long _mismatched;
+  unsigned long _missed;
+  unsigned long _unexpected;
+  long _lag;
+
+  bool readEvent();
+  void expect();
+  void dropPacket();
+  void expire();
+  void resync(const uint8_t *buffer, uint8_t l);
+
+public:
+
+  AMReplayTransport(Stream &trace, uint8_t packetSize = 20, unsigned long timeout = 1000);
+
+  bool begin(AMController *controller);
+  void poll();
+  void write(const uint8_t *buffer, uint8_t l);
+  uint8_t packetSize();
+
+  bool finished();
+  unsigned long matched();      // Recorded packets sent identical
+  unsigned long mismatched();   // Recorded packets sent with different bytes
+  unsigned long missed();       // Recorded packets not sent within the timeout
+  unsigned long unexpected();   // Bytes sent beyond the recording
+  long lag();                   // Sum of the delays [ms] of sent packets with respect to the recording
+};
+
+#endif
+
+#endif
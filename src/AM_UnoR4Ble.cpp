@@ -21,12 +21,108 @@
 */
 #include "AM_UnoR4Ble.h"
 
+#define ACTION_NONE 0
+#define ACTION_PULSE 1
+#define ACTION_BLINK 2
+#define ACTION_RAMP 3
 
-static void connectHandler(BLEDevice central);
-static void disconnectHandler(BLEDevice central);
-static void characteristicWritten(BLEDevice central, BLECharacteristic characteristic);
+#define BULK_NONE 0
+#define BULK_SDDL 1
+#define BULK_LOGDATA 2
 
-static AMController *myGlobal;
+#define RX_VARIABLE 0
+#define RX_VALUE 1
+#define RX_STREAM 2  // Value delivered to the long value handler
+#define RX_SKIP 3    // Malformed message, discarded up to #
+
+#define RX_GAP_NONE 0
+#define RX_GAP_BOUNDARY 1  // The last write dropped ended with #, the next one starts a message
+#define RX_GAP_LOST 2      // The last write dropped ended inside a message
+
+#define FLOAT_CHARS 52  // -3.4e38 with 9 decimals and the terminator
+
+#if defined(SAMPLER_SUPPORT) || defined(STREAMING_SUPPORT)
+#include "FspTimer.h"
+#endif
+
+#if defined(MEMORY_STATS_SUPPORT)
+#include <malloc.h>
+
+// Defined by the linker script
+extern "C" char __StackLimit;
+extern "C" char __StackTop;
+extern "C" char __HeapBase;
+extern "C" char __HeapLimit;
+
+#define STACK_PAINT 0xA5
+#endif
+
+// The sampler and streaming timer interrupts use the ADC as well: conversions started from loop()
+// run with interrupts masked, so that an interrupt never starts one in the middle of them
+static uint16_t adcRead(uint8_t pin) {
+  noInterrupts();
+  uint16_t value = analogRead(pin);
+  interrupts();
+  return value;
+}
+
+#if defined(SAMPLER_SUPPORT)
+
+typedef struct {
+  uint8_t pin;
+  uint8_t filter;
+  uint8_t param;
+  uint8_t head;
+  uint8_t count;
+  uint16_t ring[SAMPLER_RING];
+  uint32_t sum;        // Sum of the last param samples (moving average)
+  uint32_t ema;        // Exponential average << 8
+  volatile uint16_t value;
+} samplerChannel;
+
+static samplerChannel samplerChannels[MAX_SAMPLER_CHANNELS];
+static uint8_t samplerChannelsCount = 0;
+static bool samplerRunning = false;
+static FspTimer samplerTimer;
+
+static int8_t samplerChannelIndex(uint8_t pin) {
+  for (uint8_t i = 0; i < samplerChannelsCount; i++) {
+    if (samplerChannels[i].pin == pin)
+      return i;
+  }
+  return -1;
+}
+
+#endif
+
+#if defined(STREAMING_SUPPORT)
+
+static volatile uint16_t streamRing[STREAM_RING];
+static volatile uint16_t streamHead = 0;      // Next sample written
+static volatile uint16_t streamCount = 0;     // Samples not yet sent
+static volatile uint32_t streamTaken = 0;     // Samples taken since streamBegin(), sequence number of the next sample
+static volatile uint32_t streamLost = 0;      // Overruns
+static int8_t streamPin = -1;                 // -1 when samples are pushed by the sketch
+static bool streamRunning = false;
+static FspTimer streamTimer;
+
+// When the ring is full the oldest sample is discarded, frames are always built from the latest samples
+static void streamPut(uint16_t value) {
+  streamRing[streamHead] = value;
+  streamHead = (streamHead + 1) % STREAM_RING;
+  if (streamCount < STREAM_RING)
+    streamCount++;
+  else
+    streamLost++;
+  streamTaken++;
+}
+
+#endif
+
+
+#if defined(ALARMS_SUPPORT)
+static volatile bool checkAlarmsNow = false;  // true if it's time to check alarms, set by the RTC alarm
+#endif
 
 AMController::AMController(
   void (*doWork)(void),
@@ -45,20 +141,90 @@ AMController::AMController(
 
   _connected = false;
   _connectionChanged = false;
-  myGlobal = this;
-
+  _dataAvailable = false;
+  _remainBuffer[0] = '\0';
+  _rxMicros = 0;
+  _rxWritesCount = 0;
+  _rxOverruns = 0;
+  _rxGap = RX_GAP_NONE;
+  _rxState = RX_VARIABLE;
+  _rxVariableLength = 0;
+  _rxValue = _rxShortValue;
+  _rxValueSize = VALUELEN;
+  _rxValueLength = 0;
+  _longValueHandler = NULL;
+  _coalescedCount = 0;
+  _coalescedPending = 0;
+  _coalesceWindow = 0;
+  _coalesceOrder = 0;
+  _rxCoalesced = 0;
+  _transport = &_bleTransport;
+  _profile = PROFILE_INTERACTIVE;
+  memset(_timedActions, 0, sizeof(_timedActions));
+  _txLength = 0;
+  _syncEntriesCount = 0;
+  _syncDuration = 0;
+  _txHead = 0;
+  _txCount = 0;
+  _txDropped = 0;
+  _txConflated = 0;
+  _conflatedCount = 0;
+#if defined(STATISTICS_SUPPORT)
+  _statsCount = 0;
+#endif
+#if defined(ANALOG_CHANNELS_SUPPORT)
+  _analogChannelsCount = 0;
+  _analogResolution = 0;
+#endif
+#if defined(MEMORY_STATS_SUPPORT)
+  _rxHighWater = 0;
+  _queueHighWater = 0;
+  _messageHighWater = 0;
+#endif
+#if defined(TRACE_SUPPORT)
+  _trace = NULL;
+#endif
 #if defined(ALARMS_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
-  _rtc = new RTClock();
+  _clockSeconds = 946684800;
+  _clockMillis = 0;
+  _clockLast = 0;
+#endif
+#ifdef SDLOGGEDATAGRAPH_SUPPORT
+  _pendingHead = 0;
+  _pendingCount = 0;
+  _pendingSpilled = 0;
+  _pendingSpill = false;
+  _logMilliseconds = false;
+  _clockSynced = false;
+#endif
+  _clientCaps = 0;
+#if defined(SD_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
+  _bulkType = BULK_NONE;
+  _bulkThroughput = 0;
 #endif
+#if defined(PERSISTENCE_SUPPORT)
+  _persistRegistered = 0;
+  _persistDirty = 0;
+  _persistInterval = PERSIST_INTERVAL;
+  _persistLoaded = false;
+  _persistValid = false;
+  _persistRestored = false;
+  _persistPendingCount = 0;
+#endif
+#ifdef SD_SUPPORT
+  _sdListValid = false;
+#endif
+
 #ifdef ALARMS_SUPPORT
+  // Alarms are evaluated only with the constructor taking processAlarms
   _processAlarms = NULL;
+  _alarmArmed = 0;
+  checkAlarmsNow = false;
 #endif
 }
 
 #if defined(ALARMS_SUPPORT)
 
-static bool checkAlarmsNow = false;  // true if it's time to check alarms
-
 AMController::AMController(
   void (*doWork)(void),
   void (*doSync)(),
@@ -70,41 +236,28 @@ AMController::AMController(
   : AMController(doWork, doSync, processIncomingMessages, processOutgoingMessages, deviceConnected, deviceDisconnected) {
 
   _processAlarms = processAlarms;
-  myGlobal = this;
 }
 #endif
 
+void AMController::setTransport(AMTransport *transport) {
+  _transport = transport;
+}
+
 void AMController::begin() {
 
   // begin initialization
-  if (!BLE.begin()) {
-    Serial.println("starting Bluetooth® Low Energy module failed!");
+  if (!_transport->begin(this)) {
+    Serial.println("starting transport failed!");
 
     while (1)
       ;
   }
 
-  // set the local name peripheral advertises
-  BLE.setLocalName("AManager");
-  BLE.setDeviceName("AManager");
-  BLE.setAdvertisedService(mainService);
+  _transport->setProfile(_profile);
 
-  // add the characteristic to the service
-  mainService.addCharacteristic(rxCharacteristic);
-  mainService.addCharacteristic(txCharacteristic);
-
-  BLE.addService(mainService);
-
-  batteryService.addCharacteristic(batteryLevelCharacteristic);
-  BLE.addService(batteryService);
-
-  // assign event handlers for connected, disconnected to peripheral
-  BLE.setEventHandler(BLEConnected, connectHandler);
-  BLE.setEventHandler(BLEDisconnected, disconnectHandler);
-  rxCharacteristic.setEventHandler(BLEWritten, characteristicWritten);
-
-  // start advertising
-  BLE.advertise();
+#if defined(MEMORY_STATS_SUPPORT)
+  paintStack();
+#endif
 
 #ifdef ALARMS_SUPPORT
 
@@ -112,14 +265,12 @@ void AMController::begin() {
     initializeAlarms();
 
     _rtc->begin();
-    // RTC must be set at time > 0, otherwise periodic callback doesn't start
+    // RTC must be set at time > 0, otherwise callbacks don't start
     // Great job Arduino!!
     //
     // 1/1/2000 : 12:00:00 AM GMT
     //
-    RTCTime startTime(946684800);
-    _rtc->setTime(startTime);
-    _rtc->setPeriodicCallback(enableCheckAlarms, Period::ONCE_EVERY_2_SEC);
+    setClock(946684800);  // Arms the RTC alarm for the first alarm due
   }
 #endif
 
@@ -130,11 +281,10 @@ void AMController::begin() {
   //
   // 1/1/2000 : 12:00:00 AM GMT
   //
-  RTCTime startTime(946684800);
-  _rtc->setTime(startTime);
+  setClock(946684800);
 #endif
 
-  Serial.println(("Bluetooth® device active, waiting for connections..."));
+  Serial.println(("Device active, waiting for connections..."));
 }
 
 void AMController::loop() {
@@ -143,46 +293,78 @@ void AMController::loop() {
 
 void AMController::loop(unsigned long _delay) {
 
-  BLE.poll();
+  _transport->poll();
+
+#if defined(PERSISTENCE_SUPPORT)
+  if (!_persistRestored) {
+    // After setup(), so that the sketch has initialized its outputs
+    _persistRestored = true;
+    persistRestore();
+  }
+#endif
 
   if (_connectionChanged) {
     _connectionChanged = false;
     if (_connected) {
-      BLE.poll();
+      _transport->poll();
       if (_deviceConnected != NULL)
         _deviceConnected();
     } else {
-      BLE.poll();
+      _transport->poll();
       if (_deviceDisconnected != NULL)
         _deviceDisconnected();
     }
   }
 
-  BLE.poll();
+  _transport->poll();
   if (_dataAvailable) {
     _dataAvailable = false;
     processIncomingData();
   }
+  flushCoalesced();
+
+  // Replies to incoming messages
+  sendInteractive();
 
   if (_sync) {
     _sync = false;
-    BLE.poll();
-    _doSync();
-    BLE.poll();
+    unsigned long syncStart = millis();
+    _transport->poll();
+    sendInteractive();
+    sendSyncVariables();
+    if (_doSync != NULL)
+      _doSync();
+    _transport->poll();
+    _syncDuration = millis() - syncStart;
+    PRINTMSG("Sync time [ms]:", _syncDuration);
+  }
+
+  serviceTimedActions();
+
+#if defined(PERSISTENCE_SUPPORT)
+  if (_persistDirty != 0 && millis() - _persistDirtySince >= _persistInterval) {
+    persistFlush();
   }
+#endif
+
+#if defined(STATISTICS_SUPPORT)
+  serviceStatistics();
+#endif
 
-  BLE.poll();
+  _transport->poll();
   _doWork();
 
   if (_connected) {
-    BLE.poll();
+    _transport->poll();
     _processOutgoingMessages();
   }
 
-  BLE.poll();
+  serviceTx();
+
+  _transport->poll();
 #ifdef ALARMS_SUPPORT
   // CheckAlarms
-  if (checkAlarmsNow) {
+  if (checkAlarmsNow && _processAlarms != NULL) {
     checkAndFireAlarms();
   }
 #endif
@@ -192,100 +374,294 @@ void AMController::loop(unsigned long _delay) {
 
 
 void AMController::processIncomingData() {
+  uint8_t l = strlen(_remainBuffer);
 
-  char _variable[VARIABLELEN + 1];
-  char _value[VALUELEN + 1];
-  bool _var = true;
-  uint8_t _idx = 0;
-  int lastPound = -1;
+  // All the data received since the previous call is parsed in one pass, without polling the transport
+  for (uint8_t i = 0; i < l; i++) {
+    char c = _remainBuffer[i];
+
+    switch (_rxState) {
+      case RX_VARIABLE:
+        if (c == '=') {
+          _rxVariable[_rxVariableLength] = '\0';
+          _rxValueLength = 0;
+          _rxState = RX_VALUE;
+        } else if (c == '#') {
+          // No value, discarded
+          _rxVariableLength = 0;
+        } else if (_rxVariableLength < VARIABLELEN) {
+          _rxVariable[_rxVariableLength++] = c;
+        } else {
+          // Name too long, the message is discarded
+          _rxState = RX_SKIP;
+        }
+        break;
+
+      case RX_VALUE:
+        if (c == '#') {
+          _rxValue[_rxValueLength] = '\0';
+          _rxState = RX_VARIABLE;
+          _rxVariableLength = 0;
+          _rxMicros = rxMicrosAt(i);
+          dispatchMessage(_rxVariable, _rxValue);
+          break;
+        }
+        if (_rxValueLength < _rxValueSize) {
+          _rxValue[_rxValueLength++] = c;
+          break;
+        }
+        if (_longValueHandler == NULL) {
+          // Truncated
+          break;
+        }
+        // Too long for the buffer, what has been received so far and the rest are delivered in chunks
+        _longValueHandler(_rxVariable, VALUE_BEGIN, "", 0);
+        _longValueHandler(_rxVariable, VALUE_DATA, _rxValue, _rxValueLength);
+        _rxState = RX_STREAM;
+        // fall through
+
+      case RX_STREAM:
+        {
+          // Everything up to # or to the end of the received data in a single chunk
+          uint8_t n = 0;
+          while (i + n < l && _remainBuffer[i + n] != '#')
+            n++;
+          if (n > 0) {
+            _longValueHandler(_rxVariable, VALUE_DATA, &_remainBuffer[i], n);
+          }
+          i += n;
+          if (i < l) {
+            _rxState = RX_VARIABLE;
+            _rxVariableLength = 0;
+            _longValueHandler(_rxVariable, VALUE_END, "", 0);
+          }
+        }
+        break;
 
-  _variable[0] = '\0';
-  _value[0] = '\0';
+      case RX_SKIP:
+        if (c == '#') {
+          _rxState = RX_VARIABLE;
+          _rxVariableLength = 0;
+        }
+        break;
+    }
+  }
 
-  uint8_t l = strlen(_remainBuffer);
+  // Keeps data received while parsing (handlers may poll the transport)
+  memmove(_remainBuffer, &_remainBuffer[l], strlen(&_remainBuffer[l]) + 1);
 
-  //Serial.print("Full buffer before >"); Serial.print(_remainBuffer); Serial.println("<");
+  if (_rxGap != RX_GAP_NONE && _remainBuffer[0] == '\0') {
+    // All the data received before the dropped writes is parsed: the message in progress lost its end
+    if (_rxState != RX_VARIABLE || _rxVariableLength > 0) {
+      if (_rxState == RX_STREAM) {
+        _longValueHandler(_rxVariable, VALUE_ABORT, "", 0);
+      }
+      _rxState = RX_VARIABLE;
+      _rxVariableLength = 0;
+    }
+    // What follows the dropped writes is discarded up to # unless they ended on a message boundary
+    if (_rxGap == RX_GAP_LOST) {
+      _rxState = RX_SKIP;
+    }
+    _rxGap = RX_GAP_NONE;
+  }
 
-  for (uint8_t i = 0; i < l; i++) {
+  uint8_t kept = 0;
+  for (uint8_t w = 0; w < _rxWritesCount; w++) {
+    if (_rxWrites[w].end > l) {
+      _rxWrites[kept].end = _rxWrites[w].end - l;
+      _rxWrites[kept++].micros = _rxWrites[w].micros;
+    }
+  }
+  _rxWritesCount = kept;
 
-    BLE.poll();
+  // End of the batch
+  flushCoalesced();
 
-    if (_var) {
-      if (_remainBuffer[i] != '=') {
-        _variable[_idx++] = _remainBuffer[i];
-      } else {
-        _variable[_idx] = '\0';
-        _var = false;
-        _idx = 0;
-      }
-    } else {
-      if (_remainBuffer[i] == '#') {
-        lastPound = i;
-      }
-      if (_remainBuffer[i] != '#') {
-        _value[_idx++] = _remainBuffer[i];
-      } else {
-        _value[_idx] = '\0';
-        _var = true;
-        _idx = 0;
+#ifdef DEBUG
+  Serial.print("Full buffer after  >");
+  Serial.print(_remainBuffer);
+  Serial.println("<");
+#endif
+}
 
-        if (strlen(_value) > 0 && strcmp(_variable, "Sync") == 0) {
-          _sync = true;
-        } else
+void AMController::dispatchMessage(char *variable, char *value) {
+
+  if (strcmp(variable, "$Ping$") == 0) {
+    // Answered before anything else, for latency measurements
+    sendPong(value, micros());
+  } else if (strlen(value) > 0 && strcmp(variable, "Sync") == 0) {
+    _sync = true;
+  } else if (strcmp(variable, "$Caps$") == 0) {
+    // Optional protocol features supported by the client
+    _clientCaps = 0;
+    if (strchr(value, 'B') != NULL)
+      _clientCaps |= CAP_FRAMED_DOWNLOAD;
+#if defined(COMPRESSION_SUPPORT)
+    if (strchr(value, 'Z') != NULL)
+      _clientCaps |= CAP_COMPRESSION;
+#endif
+  } else
+#if defined(MEMORY_STATS_SUPPORT)
+    if (strcmp(variable, "$Mem$") == 0) {
+    sendMemoryStats();
+  } else
+#endif
 #if defined(ALARMS_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
-          if (strcmp(_variable, "$Time$") == 0) {
-          unsigned long unixTime = atol(_value);
-          RTCTime timeToSet = RTCTime(unixTime);
-          PRINTMSG("Setting current time at:", timeToSet.toString());
-          _rtc->setTime(timeToSet);
-        } else
+    if (strcmp(variable, "$Time$") == 0) {
+    unsigned long unixTime = atol(value);
+    PRINTMSG("Setting current time at:", unixTime);
+#ifdef SDLOGGEDATAGRAPH_SUPPORT
+    // Before the clock changes, samples logged so far are relative to it
+    sdLogRebase(unixTime);
+#endif
+    setClock(unixTime);
+  } else
 #endif
 #ifdef ALARMS_SUPPORT
-          if (strlen(_value) > 0 && (strcmp(_variable, "$AlarmId$") == 0 || strcmp(_variable, "$AlarmT$") == 0 || strcmp(_variable, "$AlarmR$") == 0)) {
-          manageAlarms(_variable, _value);
-        } else
+    if (strlen(value) > 0 && (strcmp(variable, "$AlarmId$") == 0 || strcmp(variable, "$AlarmT$") == 0 || strcmp(variable, "$AlarmR$") == 0)) {
+    manageAlarms(variable, value);
+  } else
 #endif
 #ifdef SD_SUPPORT
-          if (strlen(_variable) > 0 && (strcmp(_variable, "SD") == 0 || strcmp(_variable, "$SDDL$") == 0)) {
-          manageSD(_variable, _value);
-        } else
+    if (strlen(variable) > 0 && (strcmp(variable, "SD") == 0 || strcmp(variable, "$SDP$") == 0 || strcmp(variable, "$SDDL$") == 0)) {
+    manageSD(variable, value);
+  } else
 #endif
-          if (strlen(_variable) > 0 && strlen(_value) > 0) {
+    if (strlen(variable) > 0 && strlen(value) > 0) {
 #ifdef SDLOGGEDATAGRAPH_SUPPORT
-          if (strlen(_variable) > 0 && strcmp(_variable, "$SDLogData$") == 0) {
-            Serial.print("Logged data request for: ");
-            Serial.println(_value);
-            sdSendLogData(_value);
-          } else
-#endif
-          {
-            // Process incoming messages
+    if (strlen(variable) > 0 && strcmp(variable, "$SDLogData$") == 0) {
+      Serial.print("Logged data request for: ");
+      Serial.println(value);
+      sdSendLogData(value);
+    } else
+#endif
+    if (!coalesceMessage(variable, value)) {
+      // Values kept for continuous controls were received before this message
+      flushCoalesced(true);
+      deliverMessage(variable, value);
+    }
+  }
+}
+
+void AMController::deliverMessage(char *variable, char *value) {
+  // Process incoming messages
 #ifdef DEBUG
-            Serial.print("process ");
-            Serial.print(_variable);
-            Serial.print(" -> ");
-            Serial.println(_value);
+  Serial.print("process ");
+  Serial.print(variable);
+  Serial.print(" -> ");
+  Serial.println(value);
 #endif
-            _processIncomingMessages(_variable, _value);
-          }
-        }
-      }
+#if defined(PERSISTENCE_SUPPORT)
+  persistStore(variable, value);
+#endif
+  _processIncomingMessages(variable, value);
+}
+
+bool AMController::coalesceVariable(const char *variable) {
+
+  if (_coalescedCount >= MAX_COALESCED) {
+    PRINTMSG("Too many coalesced variables, ignored", variable);
+    return false;
+  }
+
+  coalescedEntry *e = &_coalesced[_coalescedCount++];
+  e->variable = variable;
+  e->pending = false;
+  return true;
+}
+
+void AMController::setCoalesceWindow(unsigned long window) {
+  _coalesceWindow = window;
+}
+
+unsigned long AMController::coalescedMessages() {
+  return _rxCoalesced;
+}
+
+// Keeps value until the end of the batch or of the window, replacing the previous one
+bool AMController::coalesceMessage(const char *variable, const char *value) {
+
+  if (strlen(value) > VALUELEN) {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < _coalescedCount; i++) {
+    coalescedEntry *e = &_coalesced[i];
+    if (strcmp(e->variable, variable) != 0)
+      continue;
+
+    if (e->pending) {
+      _rxCoalesced++;
+    } else {
+      if (_coalescedPending++ == 0)
+        _coalesceStart = millis();
+      e->pending = true;
+      e->order = _coalesceOrder++;
     }
+    strcpy(e->value, value);
+    return true;
   }
 
-  if (lastPound == l - 1) {
-    _remainBuffer[0] = '\0';
-  } else if (lastPound > 0) {
-    char tmp[128];
-    strcpy(tmp, &_remainBuffer[lastPound + 1]);
-    strcpy(_remainBuffer, tmp);
+  return false;
+}
+
+// Pending values delivered in the order they were first received. With force the window is not waited for
+void AMController::flushCoalesced(bool force) {
+  char variable[VARIABLELEN + 1];
+  char value[VALUELEN + 1];
+
+  if (_coalescedPending == 0 || (!force && millis() - _coalesceStart < _coalesceWindow)) {
+    return;
   }
 
-#ifdef DEBUG
-  Serial.print("Full buffer after  >");
-  Serial.print(_remainBuffer);
-  Serial.println("<");
-#endif
+  while (_coalescedPending > 0) {
+    coalescedEntry *e = NULL;
+    for (uint8_t i = 0; i < _coalescedCount; i++) {
+      if (_coalesced[i].pending && (e == NULL || (uint8_t)(_coalesced[i].order - e->order) >= 0x80))
+        e = &_coalesced[i];
+    }
+
+    // Copied and cleared first, a newer value may be received while the sketch processes this one
+    strncpy(variable, e->variable, VARIABLELEN);
+    variable[VARIABLELEN] = '\0';
+    strcpy(value, e->value);
+    e->pending = false;
+    _coalescedPending--;
+    deliverMessage(variable, value);
+  }
+}
+
+void AMController::clearCoalesced() {
+  for (uint8_t i = 0; i < _coalescedCount; i++) {
+    _coalesced[i].pending = false;
+  }
+  _coalescedPending = 0;
+}
+
+bool AMController::setValueBufferSize(uint16_t size) {
+
+  if (_rxValue != _rxShortValue) {
+    // Allocated once
+    return false;
+  }
+  if (size <= VALUELEN) {
+    return true;
+  }
+
+  char *buffer = (char *)malloc(size + 1);
+  if (buffer == NULL) {
+    return false;
+  }
+
+  buffer[0] = '\0';
+  _rxValue = buffer;
+  _rxValueSize = size;
+  return true;
+}
+
+void AMController::setLongValueHandler(void (*handler)(const char *variable, AMValueChunk chunk, const char *data, uint16_t length)) {
+  _longValueHandler = handler;
 }
 
 void AMController::writeMessage(const char *variable, int value) {
@@ -294,11 +670,8 @@ void AMController::writeMessage(const char *variable, int value) {
   if (!_connected) {
     return;
   }
-  memset(&buffer, 0, 128);
   snprintf(buffer, 128, "%s=%d#", variable, value);
-  writeBuffer((uint8_t *)&buffer, strlen(buffer));
-  BLE.poll();
-  delay(WRITE_DELAY);
+  enqueueMessage(buffer, strlen(buffer));
 }
 
 void AMController::writeMessage(const char *variable, float value) {
@@ -307,143 +680,1659 @@ void AMController::writeMessage(const char *variable, float value) {
   if (!_connected) {
     return;
   }
-  memset(&buffer, 0, 128);
   snprintf(buffer, 128, "%s=%.5f#", variable, value);
-  writeBuffer((uint8_t *)&buffer, strlen(buffer));
-  BLE.poll();
-  delay(WRITE_DELAY);
+  enqueueMessage(buffer, strlen(buffer));
 }
 
-void AMController::writeTripleMessage(const char *variable, float vX, float vY, float vZ) {
-  char buffer[VARIABLELEN + VALUELEN + 3];
+AMTopic::AMTopic(const char *variable) {
+  strncpy(prefix, variable, VARIABLELEN);
+  prefix[VARIABLELEN] = '\0';
+  length = strlen(prefix);
+  prefix[length++] = '=';
+  prefix[length] = '\0';
+  conflated = -1;
+  conflatedCount = 0;
+}
+
+// Decimal digits of value, returns the number of characters
+static uint8_t formatInt(char *out, long value) {
+  char digits[10];
+  uint8_t n = 0;
+  uint8_t l = 0;
+  unsigned long v = (value < 0) ? -(unsigned long)value : value;
+
+  if (value < 0)
+    out[l++] = '-';
+
+  do {
+    digits[n++] = '0' + v % 10;
+    v /= 10;
+  } while (v > 0);
+
+  while (n > 0)
+    out[l++] = digits[--n];
+
+  return l;
+}
+
+// Same as %.*f without the printf machinery, out has to hold at least FLOAT_CHARS characters.
+// A float has no more than 9 significant digits, decimals are capped to 9
+static uint8_t formatFloat(char *out, float value, uint8_t decimals = 5) {
+  uint8_t l = 0;
+
+  if (decimals > 9)
+    decimals = 9;
+
+  if (isnan(value) || isinf(value) || fabs(value) >= 1e9) {
+    return snprintf(out, FLOAT_CHARS, "%.*f", decimals, value);
+  }
+
+  double a = value;
+  if (a < 0) {
+    out[l++] = '-';
+    a = -a;
+  }
+
+  uint32_t unit = 1;
+  for (uint8_t i = 0; i < decimals; i++)
+    unit *= 10;
+
+  // Exact in double for any float, ties rounded to even as printf does
+  double x = a * unit;
+  uint64_t scaled = (uint64_t)x;
+  double rest = x - scaled;
+  if (rest > 0.5 || (rest == 0.5 && (scaled & 1)))
+    scaled++;
+  l += formatInt(&out[l], (long)(scaled / unit));
+  if (decimals == 0)
+    return l;
+  out[l++] = '.';
+
+  uint32_t fraction = scaled % unit;
+  for (int8_t i = decimals - 1; i >= 0; i--) {
+    out[l + i] = '0' + fraction % 10;
+    fraction /= 10;
+  }
+
+  return l + decimals;
+}
+
+void AMController::writeMessage(AMTopic &topic, int value) {
+  char buffer[VARIABLELEN + 16];
 
   if (!_connected) {
     return;
   }
-  snprintf(buffer, VARIABLELEN + VALUELEN + 3, "%s=%.2f:%.2f:%.2f#", variable, vX, vY, vZ);
-  writeBuffer((uint8_t *)&buffer, strlen(buffer) * sizeof(char));
-  BLE.poll();
-  delay(WRITE_DELAY);
+  memcpy(buffer, topic.prefix, topic.length);
+  uint8_t l = topic.length + formatInt(&buffer[topic.length], value);
+  buffer[l++] = '#';
+  enqueueTopic(topic, buffer, l);
 }
 
-void AMController::writeTxtMessage(const char *variable, const char *value) {
-  char buffer[128];
+void AMController::writeMessage(AMTopic &topic, float value) {
+  char buffer[VARIABLELEN + FLOAT_CHARS + 2];
 
   if (!_connected) {
     return;
   }
-  memset(&buffer, 0, 128);
-  snprintf(buffer, 128, "%s=%s#", variable, value);
-  writeBuffer((uint8_t *)&buffer, strlen(buffer));
-  BLE.poll();
-  delay(WRITE_DELAY);
+  memcpy(buffer, topic.prefix, topic.length);
+  uint8_t l = topic.length + formatFloat(&buffer[topic.length], value);
+  buffer[l++] = '#';
+  enqueueTopic(topic, buffer, l);
 }
 
+void AMController::writeTripleMessage(const char *variable, float vX, float vY, float vZ) {
+  float values[3] = { vX, vY, vZ };
 
-/**
-	Can send a buffer longer than 20 bytes
-**/
-void AMController::writeBuffer(uint8_t *buffer, int l) {
-  uint8_t buffer1[22];
+  writeArrayMessage(variable, values, 3, 2);
+}
+
+void AMController::writeTxtMessage(const char *variable, const char *value) {
+  char buffer[TX_ENTRY_SIZE + 1];
 
   if (!_connected) {
     return;
   }
 
-  uint8_t idx = 0;
-
-  while (idx < l) {
+  if (strlen(variable) + strlen(value) + 2 <= TX_ENTRY_SIZE) {
+    snprintf(buffer, sizeof(buffer), "%s=%s#", variable, value);
+    enqueueMessage(buffer, strlen(buffer));
+    return;
+  }
 
-    uint8_t this_block_size = min(20, l - idx);
-    memset(&buffer1, '\0', 22);
-    memcpy(&buffer1, buffer + idx, this_block_size);
+  // Too long for the queue, streamed after the messages already queued
+  if (!interactiveAllowed()) {
+    _txDropped++;
+    return;
+  }
+  sendInteractive();
+  txAppend(variable);
+  txAppend("=");
+  txAppend(value);
+  txAppend("#");
+  txFlush();
+  _transport->poll();
+  delay(_transport->messageDelay());
+}
 
-    //PRINT("Sending >"); PRINT((char *)buffer1); PRINT("<"); PRINTLN();
+bool AMController::syncVariable(const char *variable, const int *value) {
+  return addSyncVariable(variable, 0, value);
+}
 
-    txCharacteristic.writeValue((uint8_t *)&buffer1, 20);
-    delay(WRITE_DELAY);
-    BLE.poll();
+bool AMController::syncVariable(const char *variable, const float *value) {
+  return addSyncVariable(variable, 1, value);
+}
 
-    idx += this_block_size;
-  }
+bool AMController::syncVariable(const char *variable, const char *value) {
+  return addSyncVariable(variable, 2, value);
 }
 
-void AMController::updateBatteryLevel(uint8_t level) {
-  if (!_connected) {
-    return;
+bool AMController::addSyncVariable(const char *variable, uint8_t type, const void *value) {
+
+  if (_syncEntriesCount >= MAX_SYNC_VARIABLES) {
+    PRINTMSG("Too many sync variables, ignored", variable);
+    return false;
   }
 
-  batteryLevelCharacteristic.writeValue(level);
-  delay(WRITE_DELAY);
+  syncEntry *e = &_syncEntries[_syncEntriesCount++];
+  e->variable = variable;
+  e->type = type;
+  e->value = value;
+
+  return true;
 }
 
-void AMController::log(const char *msg) {
-  this->writeTxtMessage("$D$", msg);
+unsigned long AMController::droppedMessages() {
+  return _txDropped;
 }
 
-void AMController::log(int msg) {
+unsigned long AMController::syncDuration() {
+  return _syncDuration;
+}
 
-  char buffer[11];
-  itoa(msg, buffer, 10);
+// All the records back to back: packets are sent only when full
+void AMController::sendSyncVariables() {
+  char buffer[FLOAT_CHARS];
 
-  this->writeTxtMessage("$D$", buffer);
+  if (!_connected || _syncEntriesCount == 0 || !interactiveAllowed()) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < _syncEntriesCount; i++) {
+    syncEntry *e = &_syncEntries[i];
+
+    txAppend(e->variable);
+    txAppend("=");
+    switch (e->type) {
+      case 0:
+        itoa(*(const int *)e->value, buffer, 10);
+        txAppend(buffer);
+        break;
+      case 1:
+        buffer[formatFloat(buffer, *(const float *)e->value)] = '\0';
+        txAppend(buffer);
+        break;
+      default:
+        txAppend((const char *)e->value);
+        break;
+    }
+    txAppend("#");
+  }
+  txFlush();
+  _transport->poll();
 }
 
-void AMController::logLn(const char *msg) {
-  this->writeTxtMessage("$DLN$", msg);
+void AMController::writeArrayMessage(const char *variable, const float *values, uint8_t n, uint8_t precision) {
+  char buffer[FLOAT_CHARS + 1];
+
+  if (!_connected) {
+    return;
+  }
+  if (!interactiveAllowed()) {
+    _txDropped++;
+    return;
+  }
+  sendInteractive();
+  txAppend(variable);
+  for (uint8_t i = 0; i < n; i++) {
+    buffer[0] = (i == 0) ? '=' : ':';
+    buffer[1 + formatFloat(&buffer[1], values[i], precision)] = '\0';
+    txAppend(buffer);
+  }
+  txAppend("#");
+  txFlush();
+  _transport->poll();
+  delay(_transport->messageDelay());
 }
 
-void AMController::logLn(int msg) {
-  char buffer[11];
-  itoa(msg, buffer, 10);
+void AMController::writeArrayMessage(const char *variable, const int *values, uint8_t n) {
+  char buffer[13];
 
-  this->writeTxtMessage("$DLN$", buffer);
+  if (!_connected) {
+    return;
+  }
+  if (!interactiveAllowed()) {
+    _txDropped++;
+    return;
+  }
+  sendInteractive();
+  txAppend(variable);
+  for (uint8_t i = 0; i < n; i++) {
+    buffer[0] = (i == 0) ? '=' : ':';
+    itoa(values[i], &buffer[1], 10);
+    txAppend(buffer);
+  }
+  txAppend("#");
+  txFlush();
+  _transport->poll();
+  delay(_transport->messageDelay());
 }
 
-void AMController::logLn(long msg) {
-  char buffer[11];
-  ltoa(msg, buffer, 10);
 
-  this->writeTxtMessage("$DLN$", buffer);
+/**
+	Can send a buffer longer than the transport packet size
+**/
+void AMController::writeBuffer(uint8_t *buffer, int l) {
+
+  if (!_connected) {
+    return;
+  }
+
+  sendInteractive();
+  txAppend(buffer, l);
+  txFlush();
 }
 
-void AMController::logLn(unsigned long msg) {
-  char buffer[11];
-  ltoa(msg, buffer, 10);
+void AMController::enqueueMessage(const char *message, uint8_t l) {
 
-  this->writeTxtMessage("$DLN$", buffer);
+  if (!_connected) {
+    return;
+  }
+
+  const char *equal = (const char *)memchr(message, '=', l);
+  uint8_t nameLength = (equal != NULL) ? equal - message + 1 : 0;
+
+  if (nameLength > 0 && !isConflated(message, nameLength - 1)) {
+    nameLength = 0;
+  }
+
+  enqueueEntry(message, l, nameLength);
 }
 
-void AMController::temporaryDigitalWrite(uint8_t pin, uint8_t value, unsigned long ms) {
-  boolean previousValue = digitalRead(pin);
+// Conflation already resolved by the caller
+void AMController::enqueueTopic(AMTopic &topic, const char *message, uint8_t l) {
+
+  // Resolved again when conflateVariable() is called after the first message
+  if (topic.conflated < 0 || topic.conflatedCount != _conflatedCount) {
+    topic.conflated = isConflated(topic.prefix, topic.length - 1) ? 1 : 0;
+    topic.conflatedCount = _conflatedCount;
+  }
 
-  digitalWrite(pin, value);
-  delay(ms);
-  digitalWrite(pin, previousValue);
+  enqueueEntry(message, l, topic.conflated ? topic.length : 0);
 }
 
-float AMController::to_voltage(float adc_value, float vref, uint8_t resolution) {
-  const float conversion_factor = vref / ((1 << resolution) - 1);
-  return adc_value * conversion_factor;
+// nameLength is the length of "name=" for conflated variables, 0 otherwise
+void AMController::enqueueEntry(const char *message, uint8_t l, uint8_t nameLength) {
+
+#if defined(MEMORY_STATS_SUPPORT)
+  _messageHighWater = max(_messageHighWater, l);
+#endif
+
+  if (l > TX_ENTRY_SIZE) {
+    // Too long for the queue, sent after the messages already queued
+    if (!interactiveAllowed()) {
+      _txDropped++;
+      return;
+    }
+    sendInteractive();
+    txAppend((const uint8_t *)message, l);
+    txFlush();
+    return;
+  }
+
+  if (nameLength > 0) {
+    // A value of the same variable still waiting is replaced in place
+    for (uint8_t i = 0; i < _txCount; i++) {
+      txEntry *e = &_txQueue[(_txHead + i) % TX_QUEUE_LEN];
+      if (e->nameLength == nameLength && memcmp(e->data, message, nameLength) == 0) {
+        memcpy(e->data, message, l);
+        e->length = l;
+        _txConflated++;
+        return;
+      }
+    }
+  }
+
+  if (_txCount == TX_QUEUE_LEN) {
+    sendInteractive();
+    if (_txCount == TX_QUEUE_LEN) {
+      // Still full (link not available), the oldest message is discarded
+      _txHead = (_txHead + 1) % TX_QUEUE_LEN;
+      _txCount--;
+      _txDropped++;
+    }
+  }
+
+  txEntry *e = &_txQueue[(_txHead + _txCount) % TX_QUEUE_LEN];
+  memcpy(e->data, message, l);
+  e->length = l;
+  e->nameLength = nameLength;
+  _txCount++;
+
+#if defined(MEMORY_STATS_SUPPORT)
+  _queueHighWater = max(_queueHighWater, _txCount);
+  _messageHighWater = max(_messageHighWater, l);
+#endif
+}
+
+bool AMController::conflateVariable(const char *variable) {
+
+  if (_conflatedCount >= MAX_CONFLATED) {
+    PRINTMSG("Too many conflated variables, ignored", variable);
+    return false;
+  }
+
+  _conflated[_conflatedCount++] = variable;
+  return true;
+}
+
+unsigned long AMController::conflatedMessages() {
+  return _txConflated;
+}
+
+unsigned long AMController::rxOverruns() {
+  return _rxOverruns;
+}
+
+#if defined(PERSISTENCE_SUPPORT)
+
+#define PERSIST_MAGIC 0x564B4D41  // AMKV
+
+bool AMController::persistVariable(const char *variable) {
+  int8_t slot = -1;
+
+  if (strlen(variable) > VARIABLELEN) {
+    PRINTMSG("Variable name too long to persist, ignored", variable);
+    return false;
+  }
+
+  persistLoad();
+
+  for (uint8_t i = 0; i < MAX_PERSISTENT; i++) {
+    if (strcmp(_persist[i].name, variable) == 0) {
+      _persistRegistered |= (1 << i);
+      return true;
+    }
+    if (slot < 0 && _persist[i].name[0] == '\0')
+      slot = i;
+  }
+
+  if (slot < 0 && !_persistRestored) {
+    // Store full of variables of previous sketches: which ones this sketch registers is known only
+    // at the end of setup(), the slot is assigned by the first loop()
+    uint8_t registered = _persistPendingCount;
+    for (uint8_t i = 0; i < MAX_PERSISTENT; i++) {
+      if (_persistRegistered & (1 << i))
+        registered++;
+      if (i < _persistPendingCount && strcmp(_persistPending[i], variable) == 0)
+        return true;
+    }
+    if (registered >= MAX_PERSISTENT) {
+      PRINTMSG("Too many persistent variables, ignored", variable);
+      return false;
+    }
+    _persistPending[_persistPendingCount++] = variable;
+    return true;
+  }
+
+  if (slot < 0) {
+    slot = persistReclaim();
+  }
+
+  if (slot < 0) {
+    PRINTMSG("Too many persistent variables, ignored", variable);
+    return false;
+  }
+
+  persistAssign(slot, variable);
+  return true;
+}
+
+// Slot of a variable stored by a previous sketch and not registered by this one, -1 if none
+int8_t AMController::persistReclaim() {
+  for (uint8_t i = 0; i < MAX_PERSISTENT; i++) {
+    if (!(_persistRegistered & (1 << i))) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void AMController::persistAssign(uint8_t slot, const char *variable) {
+  strcpy(_persist[slot].name, variable);
+  _persist[slot].value[0] = '\0';
+  _persistRegistered |= (1 << slot);
+}
+
+void AMController::setPersistInterval(unsigned long interval) {
+  _persistInterval = interval;
+}
+
+// Whole store read in a single pass, the first time it is needed
+void AMController::persistLoad() {
+  uint32_t magic;
+
+  if (_persistLoaded) {
+    return;
+  }
+  _persistLoaded = true;
+
+  EEPROM.get(PERSIST_EEPROM_BASE, magic);
+  if (magic != PERSIST_MAGIC) {
+    memset(_persist, 0, sizeof(_persist));
+    return;
+  }
+  _persistValid = true;
+
+  for (uint8_t i = 0; i < MAX_PERSISTENT; i++) {
+    EEPROM.get(PERSIST_EEPROM_BASE + sizeof(magic) + i * sizeof(persistRecord), _persist[i]);
+    _persist[i].name[VARIABLELEN] = '\0';
+    _persist[i].value[VALUELEN] = '\0';
+  }
+}
+
+// Only the RAM copy is updated, EEPROM is written by persistFlush()
+void AMController::persistStore(const char *variable, const char *value) {
+
+  for (uint8_t i = 0; i < MAX_PERSISTENT; i++) {
+    if ((_persistRegistered & (1 << i)) && strcmp(_persist[i].name, variable) == 0) {
+
+      if (strlen(value) > VALUELEN) {
+        PRINTMSG("Value too long to persist, ignored", variable);
+        return;
+      }
+
+      if (strcmp(_persist[i].value, value) != 0) {
+        strcpy(_persist[i].value, value);
+        if (_persistDirty == 0)
+          _persistDirtySince = millis();
+        _persistDirty |= (1 << i);
+      }
+      return;
+    }
+  }
+}
+
+void AMController::persistFlush() {
+  uint32_t magic = PERSIST_MAGIC;
+
+  if (_persistDirty == 0) {
+    return;
+  }
+
+  // The magic validates the whole table: the first time it is written, so are all the records,
+  // clearing whatever was left in the EEPROM
+  if (!_persistValid) {
+    _persistDirty = (uint16_t)((1UL << MAX_PERSISTENT) - 1);
+    _persistValid = true;
+  }
+
+  // put() writes only the bytes which changed
+  EEPROM.put(PERSIST_EEPROM_BASE, magic);
+
+  for (uint8_t i = 0; i < MAX_PERSISTENT; i++) {
+    if (_persistDirty & (1 << i)) {
+      EEPROM.put(PERSIST_EEPROM_BASE + sizeof(magic) + i * sizeof(persistRecord), _persist[i]);
+    }
+  }
+
+  PRINTMSG("Persistent variables written:", _persistDirty);
+  _persistDirty = 0;
+}
+
+void AMController::persistRestore() {
+
+  // Registrations are complete, any slot not registered can be reused
+  for (uint8_t i = 0; i < _persistPendingCount; i++) {
+    int8_t slot = persistReclaim();
+    if (slot >= 0) {
+      persistAssign(slot, _persistPending[i]);
+    }
+  }
+  _persistPendingCount = 0;
+
+  for (uint8_t i = 0; i < MAX_PERSISTENT; i++) {
+    if ((_persistRegistered & (1 << i)) && _persist[i].value[0] != '\0') {
+      PRINTMSG("Restoring", _persist[i].name);
+      _processIncomingMessages(_persist[i].name, _persist[i].value);
+    }
+  }
+}
+
+#endif
+
+#if defined(STATISTICS_SUPPORT)
+
+bool AMController::statisticsAdd(const char *variable, unsigned long window, unsigned long publish, bool log) {
+
+  if (_statsCount >= MAX_STATISTICS) {
+    PRINTMSG("Too many statistics, ignored", variable);
+    return false;
+  }
+
+  statsEntry *e = &_stats[_statsCount++];
+
+  memset(e, 0, sizeof(statsEntry));
+  e->variable = variable;
+  e->bucketLength = max(1UL, window / STATS_BUCKETS);
+  e->bucketStart = millis();
+  e->publishInterval = publish;
+  e->lastPublish = millis();
+  e->log = log;
+
+  return true;
+}
+
+int8_t AMController::statsIndex(const char *variable) {
+  for (uint8_t i = 0; i < _statsCount; i++) {
+    if (strcmp(_stats[i].variable, variable) == 0)
+      return i;
+  }
+  return -1;
+}
+
+// Buckets older than the window are emptied
+void AMController::statsRotate(statsEntry *e) {
+  unsigned long elapsed = millis() - e->bucketStart;
+
+  if (elapsed < e->bucketLength) {
+    return;
+  }
+
+  unsigned long n = elapsed / e->bucketLength;
+  for (unsigned long i = 0; i < min(n, (unsigned long)STATS_BUCKETS); i++) {
+    e->current = (e->current + 1) % STATS_BUCKETS;
+    e->buckets[e->current].count = 0;
+  }
+  e->bucketStart += n * e->bucketLength;
+}
+
+void AMController::statisticsUpdate(const char *variable, float value) {
+  int8_t i = statsIndex(variable);
+
+  if (i < 0) {
+    return;
+  }
+
+  statsEntry *e = &_stats[i];
+  statsRotate(e);
+
+  statsBucket *b = &e->buckets[e->current];
+  if (b->count == 0) {
+    b->mean = 0;
+    b->m2 = 0;
+    b->min = value;
+    b->max = value;
+  }
+
+  // Welford
+  b->count++;
+  float delta = value - b->mean;
+  b->mean += delta / b->count;
+  b->m2 += delta * (value - b->mean);
+
+  if (value < b->min)
+    b->min = value;
+  if (value > b->max)
+    b->max = value;
+}
+
+// Buckets merged with the parallel form of Welford (Chan et al.)
+void AMController::statsCompute(statsEntry *e, AMStatistics &s) {
+  float mean = 0;
+  float m2 = 0;
+  unsigned long count = 0;
+
+  statsRotate(e);
+
+  s.min = 0;
+  s.max = 0;
+
+  for (uint8_t i = 0; i < STATS_BUCKETS; i++) {
+    statsBucket *b = &e->buckets[i];
+
+    if (b->count == 0)
+      continue;
+
+    if (count == 0) {
+      s.min = b->min;
+      s.max = b->max;
+    } else {
+      s.min = min(s.min, b->min);
+      s.max = max(s.max, b->max);
+    }
+
+    unsigned long n = count + b->count;
+    float delta = b->mean - mean;
+    mean += delta * b->count / n;
+    m2 += b->m2 + delta * delta * count * b->count / n;
+    count = n;
+  }
+
+  s.mean = mean;
+  s.stddev = (count > 1) ? sqrt(m2 / (count - 1)) : 0;
+  s.count = count;
+}
+
+bool AMController::statistics(const char *variable, AMStatistics &statistics) {
+  int8_t i = statsIndex(variable);
+
+  if (i < 0) {
+    return false;
+  }
+
+  statsCompute(&_stats[i], statistics);
+  return true;
+}
+
+void AMController::serviceStatistics() {
+
+  for (uint8_t i = 0; i < _statsCount; i++) {
+    statsEntry *e = &_stats[i];
+    AMStatistics s;
+
+    if (e->publishInterval == 0 || millis() - e->lastPublish < e->publishInterval)
+      continue;
+
+    e->lastPublish = millis();
+    statsCompute(e, s);
+
+    if (s.count == 0)
+      continue;
+
+    float values[4] = { s.mean, s.min, s.max, s.stddev };
+    writeArrayMessage(e->variable, values, 4, 2);
+
+#ifdef SDLOGGEDATAGRAPH_SUPPORT
+    if (e->log) {
+      sdLogMs(e->variable, nowMs(), s.mean, s.min, s.max, s.stddev);
+    }
+#endif
+  }
+}
+
+#endif
+
+// $Pong$=<token>:<rx>:<dispatch>:<reply># with micros() at the reception of the write ending $Ping$, at its dispatch
+// and at the reply.
+// Sent immediately, ahead of any queued message
+void AMController::sendPong(const char *token, unsigned long dispatchMicros) {
+  char buffer[VALUELEN + 48];
+
+  if (!_connected || !interactiveAllowed()) {
+    return;
+  }
+
+  // Tokens longer than VALUELEN are cut, the reply always ends with #
+  snprintf(buffer, sizeof(buffer), "$Pong$=%.*s:%lu:%lu:%lu#", VALUELEN, token, _rxMicros, dispatchMicros, micros());
+  txAppend(buffer);
+  txFlush();
+}
+
+// Reception time of the write which carried byte i of _remainBuffer
+unsigned long AMController::rxMicrosAt(uint8_t i) {
+  for (uint8_t w = 0; w < _rxWritesCount; w++) {
+    if (i < _rxWrites[w].end)
+      return _rxWrites[w].micros;
+  }
+  return micros();
+}
+
+bool AMController::isConflated(const char *message, uint8_t nameLength) {
+  for (uint8_t i = 0; i < _conflatedCount; i++) {
+    if (strlen(_conflated[i]) == nameLength && memcmp(_conflated[i], message, nameLength) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Nothing is sent until the client enables notifications.
+// Raw SD downloads can't be interleaved with other messages unless the client supports framed downloads
+bool AMController::interactiveAllowed() {
+  if (!_transport->ready()) {
+    return false;
+  }
+#if defined(SD_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
+  if (_bulkType == BULK_SDDL && !(_clientCaps & (CAP_FRAMED_DOWNLOAD | CAP_COMPRESSION))) {
+    return false;
+  }
+#endif
+  return true;
+}
+
+// Interactive messages are packed back to back in as few packets as possible
+void AMController::sendInteractive() {
+
+  if (!_connected) {
+    _txCount = 0;
+    return;
+  }
+
+  if (_txCount == 0 || !interactiveAllowed()) {
+    return;
+  }
+
+  while (_txCount > 0) {
+    txEntry *e = &_txQueue[_txHead];
+    txAppend((const uint8_t *)e->data, e->length);
+    _txHead = (_txHead + 1) % TX_QUEUE_LEN;
+    _txCount--;
+  }
+  txFlush();
+  _transport->poll();
+}
+
+void AMController::serviceTx() {
+
+  sendInteractive();
+
+#if defined(STREAMING_SUPPORT)
+  if (streamRunning) {
+    streamStep();
+  }
+#endif
+
+#if defined(SD_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
+  // Bulk transfers only get what is left
+  if (_bulkType != BULK_NONE) {
+    bulkStep();
+  }
+#endif
+}
+
+#if defined(SD_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
+
+void AMController::bulkBegin(File &file, uint8_t type, const char *variable) {
+  sendInteractive();
+  _bulkFile = file;
+  _bulkType = type;
+  strcpy(_bulkVariable, variable);
+  _bulkStart = millis();
+  _bulkBytes = 0;
+  _bulkSent = 0;
+#if defined(COMPRESSION_SUPPORT)
+  _compressor.begin();
+#endif
+}
+
+void AMController::bulkStep() {
+  uint8_t buffer[BULK_FRAME_SIZE + 1];
+  int sent = 0;
+
+  if (!_connected) {
+    bulkEnd(false);
+    return;
+  }
+
+  if (!_transport->ready()) {
+    return;
+  }
+
+  if (_bulkType == BULK_SDDL && millis() - _bulkStart < 500) {
+    // The app needs some time after SD=$C$#
+    return;
+  }
+
+#if defined(COMPRESSION_SUPPORT)
+  if (_clientCaps & CAP_COMPRESSION) {
+    // Raw file content, compressed: the client splits lines of logged data by itself
+    uint8_t packed[BULK_FRAME_SIZE + (BULK_FRAME_SIZE + 7) / 8];
+    char header[VARIABLELEN + 12];
+
+    while (sent < BULK_FRAMES_PER_LOOP * BULK_FRAME_SIZE && _bulkFile.available()) {
+      int n = _bulkFile.read(buffer, BULK_FRAME_SIZE);
+      if (n <= 0)
+        break;
+
+      size_t k = _compressor.compress(buffer, n, packed);
+      snprintf(header, sizeof(header), "%s=$Z$%u:", _bulkVariable, (unsigned int)k);
+      txAppend(header);
+      txAppend(packed, k);
+      txAppend("#");
+      sent += n;
+      _bulkBytes += n;
+      _bulkSent += strlen(header) + k + 1;
+    }
+  } else
+#endif
+    if (_bulkType == BULK_SDDL) {
+
+    while (sent < BULK_FRAMES_PER_LOOP * BULK_FRAME_SIZE && _bulkFile.available()) {
+      int n = _bulkFile.read(buffer, BULK_FRAME_SIZE);
+      if (n <= 0)
+        break;
+
+      if (_clientCaps & CAP_FRAMED_DOWNLOAD) {
+        char header[18];
+        snprintf(header, sizeof(header), "SD=$B$%d:", n);
+        txAppend(header);
+        txAppend(buffer, n);
+        txAppend("#");
+        _bulkSent += strlen(header) + 1;
+      } else {
+        txAppend(buffer, n);
+      }
+      sent += n;
+      _bulkBytes += n;
+      _bulkSent += n;
+    }
+  } else {
+
+    while (sent < BULK_FRAMES_PER_LOOP * BULK_FRAME_SIZE) {
+      int i = 0;
+      bool eol = false;
+
+      while (_bulkFile.available()) {
+        char c = _bulkFile.read();
+        if (c == '\n') {
+          eol = true;
+          break;
+        }
+        if (i < BULK_FRAME_SIZE)
+          buffer[i++] = c;
+      }
+      if (!eol)
+        break;
+
+      buffer[i] = '\0';
+      PRINTLN((char *)buffer);
+      txAppend(_bulkVariable);
+      txAppend("=");
+      txAppend(buffer, i);
+      txAppend("#");
+      sent += i;
+      _bulkBytes += i + 1;
+      _bulkSent += strlen(_bulkVariable) + i + 2;
+    }
+  }
+
+  txFlush();
+  _transport->poll();
+
+  if (!_bulkFile.available()) {
+    bulkEnd(true);
+  }
+}
+
+void AMController::bulkEnd(bool notify) {
+
+  if (_bulkType == BULK_NONE) {
+    return;
+  }
+
+  _bulkFile.close();
+  PRINTMSG2("Bulk transfer bytes read/sent:", _bulkBytes, _bulkSent);
+
+  unsigned long elapsed = millis() - _bulkStart;
+  _bulkThroughput = (elapsed > 0) ? (uint64_t)_bulkSent * 1000 / elapsed : _bulkSent;
+  PRINTMSG("Bulk transfer throughput [bytes/s]:", _bulkThroughput);
+
+  if (notify && _connected) {
+    if (_bulkType == BULK_SDDL) {
+      txAppend("SD=$E$#");
+      PRINTLN("File sent");
+    } else {
+      txAppend(_bulkVariable);
+      txAppend("=#");
+      PRINTLN("All data sent");
+    }
+    txFlush();
+  }
+
+  _bulkType = BULK_NONE;
+}
+
+unsigned long AMController::bulkThroughput() {
+  return _bulkThroughput;
+}
+
+#endif
+
+void AMController::setProfile(AMProfile profile) {
+
+  if (profile == _profile) {
+    return;
+  }
+
+  PRINTMSG("Connection profile:", profile);
+  _profile = profile;
+  _transport->setProfile(profile);
+}
+
+AMProfile AMController::profile() {
+  return _profile;
+}
+
+void AMController::txAppend(const uint8_t *data, int l) {
+  uint8_t packetSize = min(_transport->packetSize(), TX_BUFFER_SIZE);
+
+  while (l > 0) {
+
+    uint8_t this_block_size = min((int)(packetSize - _txLength), l);
+
+    memcpy(&_txBuffer[_txLength], data, this_block_size);
+    _txLength += this_block_size;
+    data += this_block_size;
+    l -= this_block_size;
+
+    if (_txLength == packetSize) {
+      txFlush();
+    }
+  }
+}
+
+void AMController::txAppend(const char *data) {
+  txAppend((const uint8_t *)data, strlen(data));
+}
+
+void AMController::txFlush() {
+  if (_txLength > 0) {
+#if defined(TRACE_SUPPORT)
+    traceEvent('T', _txBuffer, _txLength);
+#endif
+    _transport->write(_txBuffer, _txLength);
+    _txLength = 0;
+  }
+}
+
+void AMController::updateBatteryLevel(uint8_t level) {
+  if (!_connected) {
+    return;
+  }
+
+  _transport->updateBatteryLevel(level);
+}
+
+void AMController::log(const char *msg) {
+  this->writeTxtMessage("$D$", msg);
+}
+
+void AMController::log(int msg) {
+
+  char buffer[11];
+  itoa(msg, buffer, 10);
+
+  this->writeTxtMessage("$D$", buffer);
+}
+
+void AMController::logLn(const char *msg) {
+  this->writeTxtMessage("$DLN$", msg);
+}
+
+void AMController::logLn(int msg) {
+  char buffer[11];
+  itoa(msg, buffer, 10);
+
+  this->writeTxtMessage("$DLN$", buffer);
+}
+
+void AMController::logLn(long msg) {
+  char buffer[11];
+  ltoa(msg, buffer, 10);
+
+  this->writeTxtMessage("$DLN$", buffer);
+}
+
+void AMController::logLn(unsigned long msg) {
+  char buffer[11];
+  ltoa(msg, buffer, 10);
+
+  this->writeTxtMessage("$DLN$", buffer);
+}
+
+void AMController::temporaryDigitalWrite(uint8_t pin, uint8_t value, unsigned long ms) {
+  pulsePin(pin, value, ms);
+}
+
+int8_t AMController::addTimedAction(uint8_t type, uint8_t pin) {
+
+  cancelPinActions(pin);
+
+  for (uint8_t i = 0; i < MAX_TIMED_ACTIONS; i++) {
+    timedAction *a = &_timedActions[i];
+    if (a->type == ACTION_NONE) {
+      memset(a, 0, sizeof(timedAction));
+      a->type = type;
+      a->pin = pin;
+      a->restore = digitalRead(pin);
+      a->start = millis();
+      return i;
+    }
+  }
+
+  PRINTMSG("No timed action available for pin", pin);
+  return -1;
+}
+
+int8_t AMController::pulsePin(uint8_t pin, uint8_t value, unsigned long ms) {
+  int8_t i = addTimedAction(ACTION_PULSE, pin);
+
+  if (i >= 0) {
+    _timedActions[i].onMs = ms;
+    digitalWrite(pin, value);
+  }
+  return i;
+}
+
+int8_t AMController::blinkPin(uint8_t pin, unsigned long onMs, unsigned long offMs, uint16_t times) {
+  int8_t i = addTimedAction(ACTION_BLINK, pin);
+
+  if (i >= 0) {
+    _timedActions[i].onMs = onMs;
+    _timedActions[i].offMs = offMs;
+    _timedActions[i].times = times;
+    _timedActions[i].on = true;
+    digitalWrite(pin, HIGH);
+  }
+  return i;
+}
+
+int8_t AMController::rampPin(uint8_t pin, uint16_t from, uint16_t to, unsigned long ms) {
+  int8_t i = addTimedAction(ACTION_RAMP, pin);
+
+  if (i >= 0) {
+    _timedActions[i].from = from;
+    _timedActions[i].to = to;
+    _timedActions[i].onMs = ms;
+    analogWrite(pin, from);
+  }
+  return i;
+}
+
+void AMController::cancelPinAction(int8_t id) {
+  if (id >= 0 && id < MAX_TIMED_ACTIONS && _timedActions[id].type != ACTION_NONE) {
+    endTimedAction(id);
+  }
+}
+
+void AMController::cancelPinActions(uint8_t pin) {
+  for (uint8_t i = 0; i < MAX_TIMED_ACTIONS; i++) {
+    if (_timedActions[i].type != ACTION_NONE && _timedActions[i].pin == pin) {
+      endTimedAction(i);
+    }
+  }
+}
+
+// Pulses and blinks leave the pin at its original level, ramps at the last value written
+void AMController::endTimedAction(uint8_t i) {
+  timedAction *a = &_timedActions[i];
+
+  if (a->type == ACTION_PULSE || a->type == ACTION_BLINK) {
+    digitalWrite(a->pin, a->restore);
+  }
+  a->type = ACTION_NONE;
+}
+
+void AMController::serviceTimedActions() {
+  unsigned long now = millis();
+
+  for (uint8_t i = 0; i < MAX_TIMED_ACTIONS; i++) {
+    timedAction *a = &_timedActions[i];
+    unsigned long elapsed = now - a->start;
+
+    switch (a->type) {
+      case ACTION_PULSE:
+        if (elapsed >= a->onMs) {
+          endTimedAction(i);
+        }
+        break;
+
+      case ACTION_BLINK:
+        if (a->on && elapsed >= a->onMs) {
+          digitalWrite(a->pin, LOW);
+          a->on = false;
+          a->start += a->onMs;
+        } else if (!a->on && elapsed >= a->offMs) {
+          if (a->times == 1) {
+            endTimedAction(i);
+            break;
+          }
+          if (a->times > 1)
+            a->times--;
+          digitalWrite(a->pin, HIGH);
+          a->on = true;
+          a->start += a->offMs;
+        }
+        break;
+
+      case ACTION_RAMP:
+        if (elapsed >= a->onMs) {
+          analogWrite(a->pin, a->to);
+          a->type = ACTION_NONE;
+        } else {
+          long value = a->from + ((int64_t)a->to - a->from) * elapsed / a->onMs;
+          analogWrite(a->pin, value);
+        }
+        break;
+    }
+  }
+}
+
+float AMController::to_voltage(float adc_value, float vref, uint8_t resolution) {
+  const float conversion_factor = vref / ((1 << resolution) - 1);
+  return adc_value * conversion_factor;
+}
+
+uint16_t AMController::avgAnalogRead(uint8_t pin, uint8_t samples) {
+    uint32_t sum = 0;
+
+#if defined(SAMPLER_SUPPORT)
+    // Pins sampled in background: average of the last samples (at most SAMPLER_RING) raw values, no need to block
+    int8_t k = samplerChannelIndex(pin);
+    if (samplerRunning && k >= 0 && samplerChannels[k].count > 0 && samples > 0) {
+      samplerChannel *c = &samplerChannels[k];
+
+      noInterrupts();
+      uint8_t n = min(samples, c->count);
+      for (uint8_t i = 0; i < n; i++) {
+        sum += c->ring[(c->head + SAMPLER_RING - 1 - i) % SAMPLER_RING];
+      }
+      interrupts();
+
+      return (uint16_t)(sum / n);
+    }
+#endif
+
+    for (uint8_t i = 0; i < samples; i++) {
+        sum += adcRead(pin);
+        delayMicroseconds(50);
+    }
+
+    return (uint16_t)(sum / samples);
+}
+
+#if defined(SAMPLER_SUPPORT)
+
+static uint16_t samplerMedian(samplerChannel *c) {
+  uint16_t window[SAMPLER_RING];
+  uint8_t n = min(c->count, c->param);
+
+  // Insertion sort of the last n samples
+  for (uint8_t i = 0; i < n; i++) {
+    uint16_t v = c->ring[(c->head + SAMPLER_RING - 1 - i) % SAMPLER_RING];
+    int8_t j = i - 1;
+    while (j >= 0 && window[j] > v) {
+      window[j + 1] = window[j];
+      j--;
+    }
+    window[j + 1] = v;
+  }
+
+  return window[n / 2];
+}
+
+// Timer interrupt: one sample for each channel
+static void samplerCallback(timer_callback_args_t *args) {
+
+  for (uint8_t i = 0; i < samplerChannelsCount; i++) {
+    samplerChannel *c = &samplerChannels[i];
+    uint16_t v = analogRead(c->pin);
+
+    if (c->filter == FILTER_MOVING_AVERAGE && c->count >= c->param) {
+      // Sample leaving the window
+      c->sum -= c->ring[(c->head + SAMPLER_RING - c->param) % SAMPLER_RING];
+    }
+
+    c->ring[c->head] = v;
+    c->head = (c->head + 1) % SAMPLER_RING;
+    if (c->count < SAMPLER_RING)
+      c->count++;
+
+    switch (c->filter) {
+      case FILTER_MOVING_AVERAGE:
+        c->sum += v;
+        c->value = c->sum / min(c->count, c->param);
+        break;
+      case FILTER_MEDIAN:
+        c->value = samplerMedian(c);
+        break;
+      case FILTER_EXPONENTIAL:
+        if (c->count == 1)
+          c->ema = (uint32_t)v << 8;
+        else
+          c->ema = c->ema - (c->ema >> c->param) + (((uint32_t)v << 8) >> c->param);
+        c->value = c->ema >> 8;
+        break;
+      default:
+        c->value = v;
+        break;
+    }
+  }
+}
+
+bool AMController::samplerAddChannel(uint8_t pin, AMFilter filter, uint8_t param) {
+
+  if (samplerRunning || samplerChannelsCount >= MAX_SAMPLER_CHANNELS || samplerChannelIndex(pin) >= 0) {
+    return false;
+  }
+
+  if (filter == FILTER_MOVING_AVERAGE || filter == FILTER_MEDIAN) {
+    param = constrain(param, 1, SAMPLER_RING);
+  } else if (filter == FILTER_EXPONENTIAL) {
+    param = constrain(param, 1, 8);
+  }
+
+  samplerChannel *c = &samplerChannels[samplerChannelsCount++];
+  memset(c, 0, sizeof(samplerChannel));
+  c->pin = pin;
+  c->filter = filter;
+  c->param = param;
+  c->value = adcRead(pin);
+
+  return true;
+}
+
+bool AMController::samplerBegin(float rate) {
+  uint8_t type;
+
+  if (samplerRunning || samplerChannelsCount == 0) {
+    return false;
+  }
+
+  int8_t channel = FspTimer::get_available_timer(type);
+  if (channel < 0) {
+    PRINTLN("No timer available for the sampler");
+    return false;
+  }
+
+  if (!samplerTimer.begin(TIMER_MODE_PERIODIC, type, channel, rate, 0.0f, samplerCallback)
+      || !samplerTimer.setup_overflow_irq()
+      || !samplerTimer.open()
+      || !samplerTimer.start()) {
+    PRINTLN("Sampler timer failed");
+    return false;
+  }
+
+  samplerRunning = true;
+  return true;
+}
+
+void AMController::samplerStop() {
+  if (samplerRunning) {
+    samplerTimer.stop();
+    samplerTimer.close();
+    samplerRunning = false;
+  }
+}
+
+uint16_t AMController::sampledValue(uint8_t pin) {
+  int8_t i = samplerChannelIndex(pin);
+
+  if (i < 0) {
+    return 0;
+  }
+
+  return samplerChannels[i].value;
+}
+
+#endif
+
+#if defined(ANALOG_CHANNELS_SUPPORT)
+
+int8_t AMController::analogIndex(uint8_t pin) {
+  for (uint8_t i = 0; i < _analogChannelsCount; i++) {
+    if (_analogChannels[i].pin == pin)
+      return i;
+  }
+  return -1;
+}
+
+bool AMController::analogAddChannel(uint8_t pin, float fullScale, const char *units, uint8_t resolution) {
+
+  if (_analogChannelsCount >= MAX_ANALOG_CHANNELS || analogIndex(pin) >= 0 || resolution < 1 || resolution > 14) {
+    return false;
+  }
+
+  analogChannel *c = &_analogChannels[_analogChannelsCount++];
+  memset(c, 0, sizeof(analogChannel));
+  c->pin = pin;
+  c->resolution = resolution;
+  // The only floating point computation, done once
+  c->factor = llroundf(fullScale * ANALOG_SCALE * 65536.0f / ((1 << resolution) - 1));
+  strncpy(c->units, units, ANALOG_UNITS_LEN);
+
+  return true;
+}
+
+bool AMController::analogCalibrate(uint8_t pin, const AMCalibrationPoint *points, uint8_t n) {
+  int8_t i = analogIndex(pin);
+
+  if (i < 0 || n < 2) {
+    return false;
+  }
+  for (uint8_t j = 1; j < n; j++) {
+    if (points[j].raw <= points[j - 1].raw)
+      return false;
+  }
+
+  _analogChannels[i].calibration = points;
+  _analogChannels[i].table = NULL;
+  _analogChannels[i].points = n;
+  return true;
+}
+
+bool AMController::analogLookupTable(uint8_t pin, const int32_t *table, uint8_t n) {
+  int8_t i = analogIndex(pin);
+
+  if (i < 0 || n < 2) {
+    return false;
+  }
+
+  // n - 1 intervals, a power of 2 not greater than the number of ADC codes
+  uint8_t k = 0;
+  while ((1 << k) < n - 1)
+    k++;
+  if ((1 << k) != n - 1 || k > _analogChannels[i].resolution) {
+    return false;
+  }
+
+  _analogChannels[i].table = table;
+  _analogChannels[i].calibration = NULL;
+  _analogChannels[i].points = n;
+  _analogChannels[i].shift = _analogChannels[i].resolution - k;
+  return true;
+}
+
+int32_t AMController::analogConvert(analogChannel *c) {
+
+  if (c->table != NULL) {
+    uint16_t i = c->raw >> c->shift;
+    if (i >= c->points - 1) {
+      return c->table[c->points - 1];
+    }
+    int32_t v0 = c->table[i];
+    return v0 + ((((int64_t)c->table[i + 1] - v0) * (c->raw & ((1 << c->shift) - 1))) >> c->shift);
+  }
+
+  if (c->calibration != NULL) {
+    // Segment containing raw, the first or the last one to extrapolate
+    uint8_t i = 0;
+    while (i < c->points - 2 && c->raw >= c->calibration[i + 1].raw)
+      i++;
+    const AMCalibrationPoint *p = &c->calibration[i];
+    return p[0].value + ((int64_t)p[1].value - p[0].value) * ((int32_t)c->raw - p[0].raw) / (p[1].raw - p[0].raw);
+  }
+
+  return ((int64_t)c->raw * c->factor + 0x8000) >> 16;
+}
+
+void AMController::analogScan() {
+
+  for (uint8_t i = 0; i < _analogChannelsCount; i++) {
+    analogChannel *c = &_analogChannels[i];
+
+#if defined(SAMPLER_SUPPORT)
+    // Pins sampled in background are already filtered, no need to read them again
+    if (samplerRunning && samplerChannelIndex(c->pin) >= 0) {
+      c->raw = sampledValue(c->pin);
+      c->value = analogConvert(c);
+      continue;
+    }
+#endif
+
+    // Resolution and conversion together, the timer interrupts must not read with the resolution of this channel
+    noInterrupts();
+    if (c->resolution != _analogResolution) {
+      analogReadResolution(c->resolution);
+      _analogResolution = c->resolution;
+    }
+    c->raw = analogRead(c->pin);
+    interrupts();
+    c->value = analogConvert(c);
+  }
+}
+
+float AMController::analogValue(uint8_t pin) {
+  return analogMilliValue(pin) * (1.0f / ANALOG_SCALE);
+}
+
+int32_t AMController::analogMilliValue(uint8_t pin) {
+  int8_t i = analogIndex(pin);
+
+  if (i < 0) {
+    return 0;
+  }
+
+  return _analogChannels[i].value;
+}
+
+uint16_t AMController::analogRaw(uint8_t pin) {
+  int8_t i = analogIndex(pin);
+
+  if (i < 0) {
+    return 0;
+  }
+
+  return _analogChannels[i].raw;
+}
+
+const char *AMController::analogUnits(uint8_t pin) {
+  int8_t i = analogIndex(pin);
+
+  if (i < 0) {
+    return "";
+  }
+
+  return _analogChannels[i].units;
+}
+
+#endif
+
+#if defined(STREAMING_SUPPORT)
+
+static void streamCallback(timer_callback_args_t *args) {
+  streamPut(analogRead(streamPin));
+}
+
+static const char streamDigits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+bool AMController::streamBegin(const char *variable, uint8_t pin, float rate) {
+  return streamStart(variable, pin, rate);
+}
+
+bool AMController::streamBegin(const char *variable, float rate) {
+  return streamStart(variable, -1, rate);
+}
+
+bool AMController::streamStart(const char *variable, int8_t pin, float rate) {
+  uint8_t type;
+
+  if (streamRunning || rate <= 0 || strlen(variable) > VARIABLELEN) {
+    return false;
+  }
+
+  strcpy(_streamVariable, variable);
+  _streamPeriod = (unsigned long)(1000000.0f / rate + 0.5f);
+  _streamNextSeq = 0;
+  _streamGaps = 0;
+
+  streamHead = 0;
+  streamCount = 0;
+  streamTaken = 0;
+  streamLost = 0;
+  streamPin = pin;
+
+  if (pin >= 0) {
+    int8_t channel = FspTimer::get_available_timer(type);
+    if (channel < 0) {
+      PRINTLN("No timer available for streaming");
+      return false;
+    }
+
+    if (!streamTimer.begin(TIMER_MODE_PERIODIC, type, channel, rate, 0.0f, streamCallback)
+        || !streamTimer.setup_overflow_irq()
+        || !streamTimer.open()
+        || !streamTimer.start()) {
+      PRINTLN("Streaming timer failed");
+      return false;
+    }
+  }
+
+  streamRunning = true;
+  return true;
+}
+
+void AMController::streamPush(uint16_t value) {
+  if (streamRunning && streamPin < 0) {
+    streamPut(value);
+  }
+}
+
+void AMController::streamStop() {
+  if (!streamRunning) {
+    return;
+  }
+
+  if (streamPin >= 0) {
+    streamTimer.stop();
+    streamTimer.close();
+  }
+  streamRunning = false;
+}
+
+unsigned long AMController::streamOverruns() {
+  return streamLost;
+}
+
+unsigned long AMController::streamGaps() {
+  return _streamGaps;
+}
+
+// Frames are sized to fill whole packets, samples wait in the ring until a frame is complete
+void AMController::streamStep() {
+  uint16_t samples[STREAM_MAX_SAMPLES];
+  char header[VARIABLELEN + 40];
+  char encoded[2 * STREAM_MAX_SAMPLES + 2];
+
+  if (!_connected) {
+    // Nobody to send them to
+    noInterrupts();
+    streamCount = 0;
+    _streamNextSeq = streamTaken;
+    interrupts();
+    return;
+  }
+
+  if (!_transport->ready()) {
+    return;
+  }
+
+  uint8_t packetSize = min(_transport->packetSize(), TX_BUFFER_SIZE);
+
+  for (uint8_t f = 0; f < STREAM_FRAMES_PER_LOOP; f++) {
+
+    noInterrupts();
+    uint32_t seq = streamTaken - streamCount;
+    interrupts();
+
+    snprintf(header, sizeof(header), "%s=$ST$%lu:%lu:%lu:", _streamVariable,
+             (unsigned long)((uint64_t)seq * _streamPeriod / 1000), _streamPeriod, (unsigned long)seq);
+
+    uint8_t headerLength = strlen(header);
+    uint16_t frameLength = headerLength + 2 * STREAM_MIN_SAMPLES + 1;
+    frameLength = ((frameLength + packetSize - 1) / packetSize) * packetSize;
+    if ((frameLength - headerLength - 1) & 1) {
+      // Samples take 2 characters: a leading zero on t makes the frame end on the packet boundary
+      uint8_t t = strlen(_streamVariable) + 5;
+      memmove(header + t + 1, header + t, headerLength - t + 1);
+      header[t] = '0';
+      headerLength++;
+    }
+    uint8_t n = min((frameLength - headerLength - 1) / 2, STREAM_MAX_SAMPLES);
+
+    noInterrupts();
+    if (streamCount < n) {
+      interrupts();
+      break;
+    }
+    if (streamTaken - streamCount != seq) {
+      // Oldest samples discarded by the timer in the meantime, the header is stale
+      interrupts();
+      continue;
+    }
+    uint16_t tail = (streamHead + STREAM_RING - streamCount) % STREAM_RING;
+    for (uint8_t i = 0; i < n; i++) {
+      samples[i] = streamRing[(tail + i) % STREAM_RING];
+    }
+    streamCount -= n;
+    interrupts();
+
+    if (seq != _streamNextSeq) {
+      _streamGaps++;
+    }
+    _streamNextSeq = seq + n;
+
+    for (uint8_t i = 0; i < n; i++) {
+      uint16_t v = min(samples[i], (uint16_t)4095);
+      encoded[2 * i] = streamDigits[v >> 6];
+      encoded[2 * i + 1] = streamDigits[v & 0x3F];
+    }
+    encoded[2 * n] = '#';
+    encoded[2 * n + 1] = '\0';
+
+    txAppend(header);
+    txAppend(encoded);
+  }
+  txFlush();
+}
+
+#endif
+
+#if defined(ALARMS_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
+
+void AMController::setClock(unsigned long unixTime) {
+  RTCTime timeToSet = RTCTime(unixTime);
+
+  _rtc->setTime(timeToSet);
+  _clockSeconds = unixTime;
+  _clockMillis = millis();
+  _clockLast = _clockMillis;
+
+#ifdef ALARMS_SUPPORT
+  if (_processAlarms != NULL) {
+    // RTC time changed, alarm armed again
+    _alarmArmed = 0;
+    scheduleAlarms();
+  }
+#endif
+}
+
+unsigned long AMController::now() {
+  return nowMs() / 1000;
 }
 
-uint16_t AMController::avgAnalogRead(uint8_t pin, uint8_t samples) {
-    uint32_t sum = 0;
+uint64_t AMController::nowMs() {
+  unsigned long current = millis();
 
-    for (uint8_t i = 0; i < samples; i++) {
-        sum += analogRead(pin);  
-        delayMicroseconds(50);
-    }
+  if (current < _clockLast) {
+    // millis() wrapped around since the last call, how many times is unknown: anchored to the RTC again
+    RTCTime time;
+    _rtc->getTime(time);
+    _clockSeconds = time.getUnixTime();
+    _clockMillis = current;
+  }
+  _clockLast = current;
 
-    return (uint16_t)(sum / samples);
-}
+  unsigned long elapsed = current - _clockMillis;
 
-#if defined(ALARMS_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
+  // Anchor moved forward once a day, so that elapsed never gets close to the wrap around
+  if (elapsed >= 86400000UL) {
+    _clockSeconds += elapsed / 1000;
+    _clockMillis += (elapsed / 1000) * 1000;
+    elapsed = elapsed % 1000;
+  }
 
-unsigned long AMController::now() {
-  RTCTime currentTime;
-  _rtc->getTime(currentTime);
-  return currentTime.getUnixTime();
+  return (uint64_t)_clockSeconds * 1000 + elapsed;
 }
 
 #endif
@@ -485,19 +2374,21 @@ void AMController::manageAlarms(char *variable, char *value) {
   PRINTLN(value);
 
   if (strcmp(variable, "$AlarmId$") == 0) {
-    strcpy(_alarmId, value);
+    strncpy(_alarmId, value, sizeof(_alarmId) - 1);
+    _alarmId[sizeof(_alarmId) - 1] = '\0';
   } else if (strcmp(variable, "$AlarmT$") == 0) {
     _alarmTime = atol(value);
   } else if (strcmp(variable, "$AlarmR$") == 0) {
     if (_alarmTime == 0) {
       PRINTMSG("Deleting Alarm ", _alarmId);
-      BLE.poll();
+      _transport->poll();
       removeAlarm(_alarmId);
     } else {
       PRINTMSG("Adding/Updating Alarm ", _alarmId);
-      BLE.poll();
+      _transport->poll();
       createUpdateAlarm(_alarmId, _alarmTime, atoi(value));
     }
+    scheduleAlarms();
 #ifdef DEBUG
     dumpAlarms();
 #endif
@@ -561,7 +2452,7 @@ void AMController::removeAlarm(char *id) {
 #ifdef DEBUG
 void AMController::dumpAlarms() {
 
-  BLE.poll();
+  _transport->poll();
 
   Serial.println("\t----Current Alarms -----");
 
@@ -584,11 +2475,68 @@ void AMController::enableCheckAlarms() {
   checkAlarmsNow = true;
 }
 
+// Programs the RTC alarm for the first alarm due, the MCU is not woken up until then
+void AMController::scheduleAlarms() {
+  unsigned long next = 0;
+
+  if (_processAlarms == NULL) {
+    // No alarm callback: alarms set by the app are stored but never fired
+    return;
+  }
+
+  for (int i = 0; i < MAX_ALARMS; i++) {
+    alarm a;
+
+    EEPROM.get(i * sizeof(a), a);
+    if (a.id[1] != '\0' && (next == 0 || a.time < next)) {
+      next = a.time;
+    }
+  }
+
+  if (next == 0) {
+    // A previously armed alarm may still fire, checkAndFireAlarms() finds nothing to do
+    _alarmArmed = 0;
+    return;
+  }
+
+  if (next <= this->now()) {
+    // Already due
+    _alarmArmed = next;
+    checkAlarmsNow = true;
+    return;
+  }
+
+  if (next == _alarmArmed) {
+    return;
+  }
+
+  RTCTime alarmTime = RTCTime(next);
+  AlarmMatch match;
+  match.addMatchSecond();
+  match.addMatchMinute();
+  match.addMatchHour();
+  match.addMatchDay();
+  match.addMatchMonth();
+  match.addMatchYear();
+
+  _rtc->setAlarmCallback(enableCheckAlarms, alarmTime, match);
+  _alarmArmed = next;
+
+#ifdef DEBUG_ALARMS
+  PRINTMSG("Alarm armed @", alarmTime.toString());
+#endif
+}
+
 void AMController::checkAndFireAlarms() {
 
   checkAlarmsNow = false;
 
-  unsigned long currentUnixTime = this->now();
+  if (_processAlarms == NULL) {
+    return;
+  }
+
+  // The RTC alarm fired: the armed alarm is due, even if millis() is slightly behind the RTC
+  unsigned long currentUnixTime = max(this->now(), _alarmArmed);
 
 #ifdef DEBUG_ALARMS
   RTCTime currentTime(currentUnixTime);
@@ -600,12 +2548,13 @@ void AMController::checkAndFireAlarms() {
     alarm a;
 
     EEPROM.get(i * sizeof(a), a);
-    if (a.id[1] != '\0' && a.time < currentUnixTime) {
+    if (a.id[1] != '\0' && a.time <= currentUnixTime) {
       PRINTLN(a.id);
       // First character of id is A and has to be removed
       _processAlarms(&a.id[1]);
       if (a.repeat) {
-        a.time += 86400;  // Scheduled again tomorrow
+        while (a.time <= currentUnixTime)
+          a.time += 86400;  // Scheduled again tomorrow
 #ifdef DEBUG_ALARMS
         currentTime.setUnixTime(a.time);
         PRINTMSG("larm rescheduled @", currentTime.toString());
@@ -623,6 +2572,9 @@ void AMController::checkAndFireAlarms() {
 #endif
     }
   }
+
+  _alarmArmed = 0;
+  scheduleAlarms();
 }
 
 #endif
@@ -680,6 +2632,9 @@ void AMController::sdLogLabels(const char *variable, const char *label1, const c
       dataFile.println("-");
 
     dataFile.flush();
+#ifdef SD_SUPPORT
+    sdListUpdate(variable, dataFile.size());
+#endif
     dataFile.close();
   } else {
     PRINTMSG("Error opening", variable);
@@ -688,165 +2643,271 @@ void AMController::sdLogLabels(const char *variable, const char *label1, const c
 
 
 void AMController::sdLog(const char *variable, unsigned long time, float v1) {
-  File dataFile = SD.open(variable, FILE_WRITE);
+  float values[] = { v1 };
+  sdLogValues(variable, (uint64_t)time * 1000, 1, values);
+}
 
-  if (dataFile && (time > 946684800)) {
-    dataFile.print(time);
-    dataFile.print(";");
-    dataFile.print(v1);
+void AMController::sdLog(const char *variable, unsigned long time, float v1, float v2) {
+  float values[] = { v1, v2 };
+  sdLogValues(variable, (uint64_t)time * 1000, 2, values);
+}
 
-    dataFile.print(";-;-;-;-");
-    dataFile.println();
+void AMController::sdLog(const char *variable, unsigned long time, float v1, float v2, float v3) {
+  float values[] = { v1, v2, v3 };
+  sdLogValues(variable, (uint64_t)time * 1000, 3, values);
+}
 
-    dataFile.flush();
-    dataFile.close();
-  } else {
-    PRINTMSG("Error opening", variable);
-  }
+void AMController::sdLog(const char *variable, unsigned long time, float v1, float v2, float v3, float v4) {
+  float values[] = { v1, v2, v3, v4 };
+  sdLogValues(variable, (uint64_t)time * 1000, 4, values);
 }
 
-void AMController::sdLog(const char *variable, unsigned long time, float v1, float v2) {
+void AMController::sdLog(const char *variable, unsigned long time, float v1, float v2, float v3, float v4, float v5) {
+  float values[] = { v1, v2, v3, v4, v5 };
+  sdLogValues(variable, (uint64_t)time * 1000, 5, values);
+}
 
-  File dataFile = SD.open(variable, FILE_WRITE);
+void AMController::sdLogMs(const char *variable, uint64_t time, float v1) {
+  float values[] = { v1 };
+  sdLogValues(variable, time, 1, values);
+}
 
-  if (dataFile && (time > 946684800)) {
-    dataFile.print(time);
-    dataFile.print(";");
-    dataFile.print(v1);
-    dataFile.print(";");
+void AMController::sdLogMs(const char *variable, uint64_t time, float v1, float v2) {
+  float values[] = { v1, v2 };
+  sdLogValues(variable, time, 2, values);
+}
+
+void AMController::sdLogMs(const char *variable, uint64_t time, float v1, float v2, float v3) {
+  float values[] = { v1, v2, v3 };
+  sdLogValues(variable, time, 3, values);
+}
+
+void AMController::sdLogMs(const char *variable, uint64_t time, float v1, float v2, float v3, float v4) {
+  float values[] = { v1, v2, v3, v4 };
+  sdLogValues(variable, time, 4, values);
+}
+
+void AMController::sdLogMs(const char *variable, uint64_t time, float v1, float v2, float v3, float v4, float v5) {
+  float values[] = { v1, v2, v3, v4, v5 };
+  sdLogValues(variable, time, 5, values);
+}
 
-    dataFile.print(v2);
+void AMController::sdLogValues(const char *variable, uint64_t time, uint8_t n, const float *values) {
+
+  // Checked first: held samples are stored relative to 1/1/2000
+  if (time <= 946684800000ULL) {
+    PRINTMSG("Time not set, sample discarded", variable);
+    return;
+  }
+
+  if (!_clockSynced && time < SDLOG_VALID_TIME) {
+    // Time from the clock started by begin(), written when the app sets the time
+    sdLogHold(variable, time, n, values);
+    return;
+  }
+
+  File dataFile = SD.open(variable, FILE_WRITE);
 
-    dataFile.print(";-;-;-");
-    dataFile.println();
+  if (dataFile) {
+    sdLogLine(dataFile, time, n, values);
 
     dataFile.flush();
+#ifdef SD_SUPPORT
+    sdListUpdate(variable, dataFile.size());
+#endif
     dataFile.close();
   } else {
     PRINTMSG("Error opening", variable);
   }
 }
 
-void AMController::sdLog(const char *variable, unsigned long time, float v1, float v2, float v3) {
-  File dataFile = SD.open(variable, FILE_WRITE);
+// Data is sent from loop() as a bulk transfer, interactive messages keep the priority
+// Line: time;v1;v2;v3;v4;v5 with - for missing values. Time in [s], with [ms] only when enabled and not 0
+void AMController::sdLogLine(File &file, uint64_t time, uint8_t n, const float *values) {
 
-  if (dataFile && (time > 946684800)) {
-    dataFile.print(time);
-    dataFile.print(";");
-    dataFile.print(v1);
-    dataFile.print(";");
+  file.print((unsigned long)(time / 1000));
+  if (_logMilliseconds && time % 1000 != 0) {
+    char ms[5];
+    snprintf(ms, sizeof(ms), ".%03u", (unsigned int)(time % 1000));
+    file.print(ms);
+  }
 
-    dataFile.print(v2);
-    dataFile.print(";");
+  for (uint8_t i = 0; i < 5; i++) {
+    file.print(";");
+    if (i < n)
+      file.print(values[i]);
+    else
+      file.print("-");
+  }
+  file.println();
+}
 
-    dataFile.print(v3);
+void AMController::sdLogSpill(bool spill) {
+  _pendingSpill = spill;
+}
 
-    dataFile.print(";-;-");
-    dataFile.println();
+void AMController::sdLogMilliseconds(bool enable) {
+  _logMilliseconds = enable;
+}
 
-    dataFile.flush();
-    dataFile.close();
-  } else {
-    PRINTMSG("Error opening", variable);
+unsigned long AMController::sdLogPending() {
+  return _pendingSpilled + _pendingCount;
+}
+
+void AMController::sdLogHold(const char *variable, uint64_t time, uint8_t n, const float *values) {
+
+  if (time - 946684800000ULL > 0xFFFFFFFFULL) {
+    // Kept in 32 bits: more than 49 days without the time
+    PRINTMSG("Time not set, sample discarded", variable);
+    return;
+  }
+
+  if (_pendingCount == SDLOG_PENDING) {
+    if (_pendingSpill) {
+      sdLogSpillPending();
+    } else {
+      PRINTMSG("Time not set, oldest sample discarded", _pending[_pendingHead].variable);
+      _pendingHead = (_pendingHead + 1) % SDLOG_PENDING;
+      _pendingCount--;
+    }
   }
+
+  pendingSample *p = &_pending[(_pendingHead + _pendingCount++) % SDLOG_PENDING];
+  strncpy(p->variable, variable, VARIABLELEN);
+  p->variable[VARIABLELEN] = '\0';
+  p->time = time - 946684800000ULL;
+  p->n = min(n, (uint8_t)5);
+  memcpy(p->values, values, p->n * sizeof(float));
 }
 
-void AMController::sdLog(const char *variable, unsigned long time, float v1, float v2, float v3, float v4) {
-  File dataFile = SD.open(variable, FILE_WRITE);
+// Spill line: variable;time;n;v1;...;vn with time in [ms] from 1/1/2000
+void AMController::sdLogSpillPending() {
+  File spillFile = SD.open(SDLOG_SPILL_FILE, FILE_WRITE);
 
-  if (dataFile && (time > 946684800)) {
-    dataFile.print(time);
-    dataFile.print(";");
-    dataFile.print(v1);
-    dataFile.print(";");
+  if (!spillFile) {
+    PRINTMSG("Error opening", SDLOG_SPILL_FILE);
+    return;
+  }
 
-    dataFile.print(v2);
-    dataFile.print(";");
+  for (; _pendingCount > 0; _pendingCount--) {
+    pendingSample *p = &_pending[_pendingHead];
+    spillFile.print(p->variable);
+    spillFile.print(";");
+    spillFile.print(p->time);
+    spillFile.print(";");
+    spillFile.print(p->n);
+    for (uint8_t i = 0; i < p->n; i++) {
+      spillFile.print(";");
+      spillFile.print(p->values[i]);
+    }
+    spillFile.println();
+    _pendingHead = (_pendingHead + 1) % SDLOG_PENDING;
+    _pendingSpilled++;
+  }
 
-    dataFile.print(v3);
-    dataFile.print(";");
+  spillFile.flush();
+#ifdef SD_SUPPORT
+  sdListUpdate(SDLOG_SPILL_FILE, spillFile.size());
+#endif
+  spillFile.close();
+}
 
-    dataFile.print(v4);
+// Writes to file, opened for variable, consecutive samples of the same variable go to the same open file
+void AMController::sdLogAppend(File &file, char *current, const char *variable, uint64_t time, uint8_t n, const float *values) {
 
-    dataFile.println(";-");
-    dataFile.println();
+  if (strcmp(current, variable) != 0) {
+    if (file) {
+      file.flush();
+#ifdef SD_SUPPORT
+      sdListUpdate(current, file.size());
+#endif
+      file.close();
+    }
+    strncpy(current, variable, VARIABLELEN);
+    current[VARIABLELEN] = '\0';
+    file = SD.open(current, FILE_WRITE);
+  }
 
-    dataFile.flush();
-    dataFile.close();
-  } else {
-    PRINTMSG("Error opening", variable);
+  if (file) {
+    sdLogLine(file, time, n, values);
   }
 }
 
-void AMController::sdLog(const char *variable, unsigned long time, float v1, float v2, float v3, float v4, float v5) {
+// Samples kept before the time was set are written in one batch, oldest first, moved to unixTime
+void AMController::sdLogRebase(unsigned long unixTime) {
+  uint64_t base = (uint64_t)unixTime * 1000 - (nowMs() - 946684800000ULL);
+  char current[VARIABLELEN + 1] = "";
+  File dataFile;
 
-  File dataFile = SD.open(variable, FILE_WRITE);
+  _clockSynced = true;
 
-  if (dataFile && (time > 946684800)) {
-    dataFile.print(time);
-    dataFile.print(";");
-    dataFile.print(v1);
-    dataFile.print(";");
+  if (_pendingSpilled > 0) {
+    File spillFile = SD.open(SDLOG_SPILL_FILE, FILE_READ);
+    char line[VARIABLELEN + 80];
 
-    dataFile.print(v2);
-    dataFile.print(";");
+    while (spillFile && spillFile.available()) {
+      uint8_t l = spillFile.readBytesUntil('\n', line, sizeof(line) - 1);
+      line[l] = '\0';
 
-    dataFile.print(v3);
-    dataFile.print(";");
+      char *variable = strtok(line, ";");
+      char *time = strtok(NULL, ";");
+      char *n = strtok(NULL, ";");
+      if (variable == NULL || time == NULL || n == NULL) {
+        continue;
+      }
 
-    dataFile.print(v4);
-    dataFile.print(";");
+      float values[5];
+      uint8_t count = 0;
+      char *value;
+      while (count < 5 && count < atoi(n) && (value = strtok(NULL, ";\r")) != NULL) {
+        values[count++] = atof(value);
+      }
+      sdLogAppend(dataFile, current, variable, base + strtoul(time, NULL, 10), count, values);
+    }
 
-    dataFile.println(v5);
+    if (spillFile) {
+      spillFile.close();
+    }
+    SD.remove(SDLOG_SPILL_FILE);
+#ifdef SD_SUPPORT
+    sdInvalidateList();
+#endif
+    _pendingSpilled = 0;
+  }
 
-    dataFile.println();
+  for (; _pendingCount > 0; _pendingCount--) {
+    pendingSample *p = &_pending[_pendingHead];
+    sdLogAppend(dataFile, current, p->variable, base + p->time, p->n, p->values);
+    _pendingHead = (_pendingHead + 1) % SDLOG_PENDING;
+  }
 
+  if (dataFile) {
     dataFile.flush();
+#ifdef SD_SUPPORT
+    sdListUpdate(current, dataFile.size());
+#endif
     dataFile.close();
-  } else {
-    PRINTMSG("Error opening", variable);
   }
 }
 
 void AMController::sdSendLogData(const char *variable) {
-  char fileNameBuffer[VARIABLELEN + 1];
+  char fileNameBuffer[VARIABLELEN + 2];
 
   strcpy(fileNameBuffer, "/");
-  strcat(fileNameBuffer, variable);
+  strncat(fileNameBuffer, variable, VARIABLELEN);
+
+  bulkEnd(true);  // One bulk transfer at a time
 
   File dataFile = SD.open(fileNameBuffer);
 
   if (dataFile) {
-
-    char c;
-    char buffer[128];
-    int i = 0;
-
     dataFile.seek(0);
 
-    while (dataFile.available()) {
-
-      c = dataFile.read();
-
-      if (c == '\n') {
-
-        buffer[i++] = '\0';
-        PRINTLN(buffer);
-        this->writeTxtMessage(variable, buffer);
-
-        i = 0;
-      } else
-        buffer[i++] = c;
-    }
-
-    PRINTLN("All data sent");
-
-    dataFile.close();
+    bulkBegin(dataFile, BULK_LOGDATA, &fileNameBuffer[1]);
   } else {
     PRINTMSG("Error opening", variable);
+    this->writeTxtMessage(variable, "");
   }
-
-  this->writeTxtMessage(variable, "");
 }
 
 // Size in Kbytes
@@ -862,11 +2923,14 @@ uint16_t AMController::sdFileSize(const char *variable) {
 }
 
 void AMController::sdPurgeLogData(const char *variable) {
-  char fileNameBuffer[VARIABLELEN + 1];
+  char fileNameBuffer[VARIABLELEN + 2];
 
   strcpy(fileNameBuffer, "/");
-  strcat(fileNameBuffer, variable);
+  strncat(fileNameBuffer, variable, VARIABLELEN);
   SD.remove(fileNameBuffer);
+#ifdef SD_SUPPORT
+  sdInvalidateList();
+#endif
 }
 
 #endif
@@ -875,21 +2939,114 @@ void AMController::sdPurgeLogData(const char *variable) {
 
 void AMController::connected(void) {
   _connected = true;
+#if defined(TRACE_SUPPORT)
+  traceEvent('C', NULL, 0);
+#endif
   if (_deviceConnected != NULL)
     _deviceConnected();
 }
 
 void AMController::disconnected(void) {
   _connected = false;
+#if defined(TRACE_SUPPORT)
+  traceEvent('D', NULL, 0);
+#endif
   _remainBuffer[0] = '\0';
+  _rxWritesCount = 0;
+  _rxGap = RX_GAP_NONE;
+  clearCoalesced();  // Not applied in the next session
+  if (_rxState == RX_STREAM) {
+    _longValueHandler(_rxVariable, VALUE_ABORT, "", 0);
+  }
+  _rxState = RX_VARIABLE;
+  _rxVariableLength = 0;
+  _txLength = 0;
+  _txCount = 0;
+  _clientCaps = 0;
   if (_deviceDisconnected != NULL)
     _deviceDisconnected();
 }
 
 
 void AMController::dataAvailable(String data) {
-  strcat(_remainBuffer, data.c_str());
+  dataAvailable(data.c_str(), strlen(data.c_str()));
+}
+
+void AMController::dataAvailable(const char *data, uint8_t l) {
+  unsigned long now = micros();
+#if defined(TRACE_SUPPORT)
+  traceEvent('R', (const uint8_t *)data, l);
+#endif
+  if (_rxGap != RX_GAP_NONE || l > rxSpace()) {
+    // Writes without response have no flow control: a write is kept whole or dropped, and the message
+    // it belonged to is discarded (see processIncomingData()) instead of being joined to the next write
+    _rxOverruns += l;
+    if (l > 0) {
+      _rxGap = (data[l - 1] == '#') ? RX_GAP_BOUNDARY : RX_GAP_LOST;
+    }
+    _dataAvailable = true;
+    return;
+  }
+  strncat(_remainBuffer, data, l);
   _dataAvailable = true;
+
+  // When full, the last entry takes the following writes as well
+  if (_rxWritesCount == RX_WRITES) {
+    _rxWritesCount--;
+  } else {
+    _rxWrites[_rxWritesCount].micros = now;
+  }
+  _rxWrites[_rxWritesCount++].end = strlen(_remainBuffer);
+
+#if defined(MEMORY_STATS_SUPPORT)
+  _rxHighWater = max(_rxHighWater, (uint8_t)strlen(_remainBuffer));
+#endif
+}
+
+#if defined(TRACE_SUPPORT)
+
+void AMController::traceBegin(Print *out) {
+  _trace = out;
+  _traceLast = millis();
+}
+
+void AMController::traceEnd() {
+  if (_trace != NULL) {
+    _trace->flush();
+    _trace = NULL;
+  }
+}
+
+void AMController::traceEvent(char type, const uint8_t *data, uint8_t l) {
+  char hex[5];
+
+  if (_trace == NULL) {
+    return;
+  }
+
+  unsigned long now = millis();
+
+  _trace->print(type);
+  _trace->print(now - _traceLast);
+  _trace->print(' ');
+  for (uint8_t i = 0; i < l; i++) {
+    if (data[i] < 32 || data[i] > 126 || data[i] == '\\') {
+      snprintf(hex, sizeof(hex), "\\x%02X", data[i]);
+      _trace->print(hex);
+    } else {
+      _trace->print((char)data[i]);
+    }
+  }
+  _trace->print('\n');
+
+  _traceLast = now;
+}
+
+#endif
+
+// Bytes which can still be accepted by dataAvailable()
+size_t AMController::rxSpace() {
+  return sizeof(_remainBuffer) - 1 - strlen(_remainBuffer);
 }
 
 #ifdef SD_SUPPORT
@@ -898,90 +3055,229 @@ void AMController::manageSD(char *variable, char *value) {
   PRINTLN("Manage SD");
 
   if (strcmp(variable, "SD") == 0) {
+    // Names only, packed in as few packets as possible
     PRINTLN("\t[File List Start]");
 
-    File dir = SD.open("/");
-    if (!dir) {
-      PRINTLN("Failed to open /");
-      return;
-    }
-    dir.rewindDirectory();
-    File entry = dir.openNextFile();
-    if (!entry) {
-      PRINTLN("\tFailed to get first file");
+    if (!interactiveAllowed()) {
+      _txDropped++;
       return;
     }
+    sendInteractive();
 
-    while (entry) {
-      if (!entry.isDirectory()) {
-        this->writeTxtMessage("SD", entry.name());
-        PRINTLN("\t" + String(entry.name()));
+    if (_sdListValid && _sdListFirst == 0 && _sdListCount == _sdListTotal) {
+      // Whole listing in the cache
+      for (uint16_t i = 0; i < _sdListCount; i++) {
+        sdListSend(&_sdList[i]);
       }
-      entry.close();
-      entry = dir.openNextFile();
+    } else {
+      // Single walk of the directory, names sent as they are read
+      sdListLoad(0, true);
     }
 
-    dir.close();
-
-    this->writeTxtMessage("SD", "$EFL$");
+    txAppend("SD=$EFL$#");
+    txFlush();
+    _transport->poll();
+    delay(_transport->messageDelay());
     PRINTLN("\t[File List End]");
   }
+  if (strcmp(variable, "$SDP$") == 0) {
+    // $SDP$=<page>;<pages>;<name>:<size>;...# with sizes in bytes, pages start from 0
+    uint16_t page = atoi(value);
+    uint16_t first = page * SD_LIST_PAGE;
+    const sdEntry *entry = sdListEntry(first);  // Loads the listing if needed
+    char buffer[SD_NAME_LEN + 16];
+
+    if (!interactiveAllowed()) {
+      _txDropped++;
+      return;
+    }
+    sendInteractive();
+
+    snprintf(buffer, sizeof(buffer), "$SDP$=%u;%u", page, (_sdListTotal + SD_LIST_PAGE - 1) / SD_LIST_PAGE);
+    txAppend(buffer);
+    for (uint16_t i = first; i < first + SD_LIST_PAGE && (entry = sdListEntry(i)) != NULL; i++) {
+      snprintf(buffer, sizeof(buffer), ";%s:%lu", entry->name, (unsigned long)entry->size);
+      txAppend(buffer);
+    }
+    txAppend("#");
+    txFlush();
+    _transport->poll();
+    delay(_transport->messageDelay());
+  }
   if (strcmp(variable, "$SDDL$") == 0) {
     PRINTMSG("Sending File: ", value);
 
+    bulkEnd(true);  // One bulk transfer at a time
+
     File dataFile = SD.open(value, FILE_READ);
     if (dataFile) {
-      unsigned long n = 0;
-      uint8_t buffer[64];
-      strcpy((char *)&buffer[0], "SD=$C$#");
-      this->writeBuffer(buffer, 7 * sizeof(uint8_t));
+      // File content is sent from loop() as a bulk transfer
+      this->writeBuffer((uint8_t *)"SD=$C$#", 7 * sizeof(uint8_t));
+      bulkBegin(dataFile, BULK_SDDL, "SD");
+    }
+  }
+}
+
+void AMController::sdListSend(const sdEntry *entry) {
+  txAppend("SD=");
+  txAppend(entry->name);
+  txAppend("#");
+  PRINTLN("\t" + String(entry->name));
+}
+
+// Walks the root directory counting its files and keeping the entries from first.
+// With send true, every entry is also sent to the app as SD=<name>#
+bool AMController::sdListLoad(uint16_t first, bool send) {
 
-      delay(500);  // OK
+  _sdListFirst = first;
+  _sdListCount = 0;
+  _sdListTotal = 0;
+  _sdListValid = false;
 
-      while (dataFile.available()) {
-        n = dataFile.read(buffer, sizeof(buffer));
-        this->writeBuffer(buffer, n * sizeof(uint8_t));
+  File dir = SD.open("/");
+  if (!dir) {
+    PRINTLN("Failed to open /");
+    return false;
+  }
+  dir.rewindDirectory();
+
+  File entry = dir.openNextFile();
+  while (entry) {
+    if (!entry.isDirectory()) {
+      sdEntry e;
+      strncpy(e.name, entry.name(), SD_NAME_LEN);
+      e.name[SD_NAME_LEN] = '\0';
+      e.size = entry.size();
+
+      if (_sdListTotal >= first && _sdListCount < SD_LIST_CACHE) {
+        _sdList[_sdListCount++] = e;
+      }
+      if (send) {
+        sdListSend(&e);
       }
-      strcpy((char *)&buffer[0], "SD=$E$#");
-      this->writeBuffer(buffer, 7 * sizeof(uint8_t));
-      delay(150);
-      dataFile.close();
+      _sdListTotal++;
+    }
+    entry.close();
+    entry = dir.openNextFile();
+  }
+  dir.close();
 
-      PRINTLN("File sent");
+  _sdListValid = true;
+  return true;
+}
+
+// NULL after the last file. The card is read again only when index is outside of the cached window
+const AMController::sdEntry *AMController::sdListEntry(uint16_t index) {
+
+  if (_sdListValid && index >= _sdListTotal) {
+    return NULL;
+  }
+
+  if (!_sdListValid || index < _sdListFirst || index >= _sdListFirst + _sdListCount) {
+    if (!sdListLoad(index - index % SD_LIST_PAGE)) {
+      return NULL;
     }
   }
+
+  if (index >= _sdListFirst + _sdListCount) {
+    return NULL;
+  }
+
+  return &_sdList[index - _sdListFirst];
+}
+
+void AMController::sdListUpdate(const char *name, uint32_t size) {
+
+  if (!_sdListValid) {
+    return;
+  }
+
+  if (name[0] == '/') {
+    name++;
+  }
+
+  for (uint16_t i = 0; i < _sdListCount; i++) {
+    if (strcasecmp(_sdList[i].name, name) == 0) {
+      _sdList[i].size = size;
+      return;
+    }
+  }
+
+  // New file or not in the cached window
+  _sdListValid = false;
+}
+
+void AMController::sdInvalidateList() {
+  _sdListValid = false;
 }
 #endif
 
-////////////////////
+#if defined(MEMORY_STATS_SUPPORT)
+
+// Stack below the current frame is filled with STACK_PAINT, memoryStats() looks for the deepest byte overwritten
+void AMController::paintStack() {
+  char here;
+  char *sp = &here - 64;  // Room for memset's own frame
+
+  if (sp <= &__StackLimit || sp > &__StackTop) {
+    // Not running on the main stack
+    return;
+  }
 
-void connectHandler(BLEDevice central) {
-  // central connected event handler
-  myGlobal->connected();
-  PRINT("\tConnected event, central: ");
-  PRINTLN(central.address());
+  memset(&__StackLimit, STACK_PAINT, sp - &__StackLimit);
 }
 
-void disconnectHandler(BLEDevice central) {
-  // central disconnected event handler
-  myGlobal->disconnected();
-  PRINT("\Disconnected event, central: ");
-  PRINTLN(central.address());
+// Binary search of the largest block malloc() can return
+static size_t largestFreeBlock(size_t limit) {
+  size_t low = 0;
+  size_t high = limit;
+
+  while (low < high) {
+    size_t size = (low + high + 1) / 2;
+    void *p = malloc(size);
+    if (p != NULL) {
+      free(p);
+      low = size;
+    } else {
+      high = size - 1;
+    }
+  }
+
+  return low;
 }
 
-void characteristicWritten(BLEDevice central, BLECharacteristic characteristic) {
+void AMController::memoryStats(AMMemoryStats &stats) {
+  const char *p = &__StackLimit;
+
+  while (p < &__StackTop && *p == (char)STACK_PAINT)
+    p++;
+
+  stats.stackSize = &__StackTop - &__StackLimit;
+  stats.stackUsed = &__StackTop - p;
+
+  // Heap not yet obtained from sbrk() plus free chunks
+  struct mallinfo info = mallinfo();
+  size_t heapSize = &__HeapLimit - &__HeapBase;
+  stats.heapFree = ((size_t)info.arena < heapSize ? heapSize - info.arena : 0) + info.fordblks;
+  stats.heapLargest = largestFreeBlock(stats.heapFree);
 
-  //PRINTLN("Characteristic event, written: ");
+  stats.rxHighWater = _rxHighWater;
+  stats.queueHighWater = _queueHighWater;
+  stats.messageHighWater = _messageHighWater;
+}
+
+void AMController::sendMemoryStats() {
+  AMMemoryStats stats;
+  char buffer[48];
 
-  char buffer[40];
-  int n = characteristic.readValue(buffer, sizeof(buffer));
-  memset(&buffer[n], 0, sizeof(buffer) - n);
-  String d = String(buffer);
+  memoryStats(stats);
 
-  PRINT("R >");
-  PRINT(d);
-  PRINT("< ");
-  PRINTLN(n);
+  snprintf(buffer, sizeof(buffer), "%u:%u:%u:%u:%u:%u:%u",
+           (unsigned int)stats.stackUsed, (unsigned int)stats.stackSize,
+           (unsigned int)stats.heapFree, (unsigned int)stats.heapLargest,
+           stats.rxHighWater, stats.queueHighWater, stats.messageHighWater);
 
-  myGlobal->dataAvailable(d);
+  writeTxtMessage("$Mem$", buffer);
 }
+
+#endif
@@ -25,14 +25,15 @@
 
 #include <Arduino.h>
 #include <ArduinoBLE.h>
+#include "AM_UnoR4Ble_Config.h"
+
+#if defined(ALARMS_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
 #include "RTC.h"
-#include <EEPROM.h>
+#endif
 
-#define ALARMS_SUPPORT            // uncomment to enable support for Alarm Widget - LEFT THIS ALONE AT THE MOMENT
-#define SD_SUPPORT                // uncomment to enable support for SD Widget  - LEFT THIS ALONE AT THE MOMENT
-#define SDLOGGEDATAGRAPH_SUPPORT  // uncomment to enable support for Logged Data Widget - LEFT THIS ALONE AT THE MOMENT
-// #define DEBUG                     // uncomment to enable debugging - You should not need it !
-// #define DEBUG_ALARMS              // uncomment to enable alarms debugging (DEBUG has to be uncommented as well)
+#if defined(ALARMS_SUPPORT) || defined(PERSISTENCE_SUPPORT)
+#include <EEPROM.h>
+#endif
 
 
 #if !defined(ARDUINO_UNOR4_WIFI)
@@ -92,28 +93,225 @@ doesn't work either.
 
 #endif
 
+#if defined(SAMPLER_SUPPORT)
+
+#define MAX_SAMPLER_CHANNELS 4  // Maximum number of analog inputs sampled in background
+#define SAMPLER_RING 16         // Samples kept for each channel (maximum filter window)
+
+typedef enum {
+  FILTER_NONE,            // Last sample
+  FILTER_MOVING_AVERAGE,  // Average of the last param samples
+  FILTER_MEDIAN,          // Median of the last param samples
+  FILTER_EXPONENTIAL      // y += (x - y) / 2^param
+} AMFilter;
+
+#endif
+
+#if defined(ANALOG_CHANNELS_SUPPORT)
+
+#define MAX_ANALOG_CHANNELS 6  // Maximum number of analog inputs registered with analogAddChannel()
+#define ANALOG_UNITS_LEN 6     // Longest engineering unit (e.g. "mbar")
+#define ANALOG_SCALE 1000      // Converted values are kept as integers in 1/ANALOG_SCALE units
+
+typedef struct {
+  uint16_t raw;   // ADC reading
+  int32_t value;  // Value at raw [1/ANALOG_SCALE units]
+} AMCalibrationPoint;
+
+#endif
+
+#if defined(STREAMING_SUPPORT)
+
+#define STREAM_RING 512          // Samples waiting to be sent
+#define STREAM_MIN_SAMPLES 16    // Minimum number of samples in a frame
+#define STREAM_MAX_SAMPLES 60    // Maximum number of samples in a frame
+#define STREAM_FRAMES_PER_LOOP 4 // Frames sent at each loop(), after the interactive queue is empty
+
+#endif
+
+#if defined(STATISTICS_SUPPORT)
+
+#define MAX_STATISTICS 4   // Maximum number of variables registered with statisticsAdd()
+#define STATS_BUCKETS 12   // The window slides by window / STATS_BUCKETS
+
+typedef struct {
+  float mean;
+  float min;
+  float max;
+  float stddev;
+  unsigned long count;  // Samples in the window
+} AMStatistics;
+
+#endif
+
+#if defined(MEMORY_STATS_SUPPORT)
+
+typedef struct {
+  size_t stackSize;
+  size_t stackUsed;          // High-water mark since begin()
+  size_t heapFree;
+  size_t heapLargest;        // Largest block malloc() can return
+  uint8_t rxHighWater;       // Bytes waiting to be parsed, of RX_BUFFER_SIZE - 1
+  uint8_t queueHighWater;    // Messages waiting to be sent, of TX_QUEUE_LEN
+  uint8_t messageHighWater;  // Longest message written
+} AMMemoryStats;
+
+#endif
+
+#if defined(PERSISTENCE_SUPPORT)
+
+#define MAX_PERSISTENT 16         // Maximum number of variables registered with persistVariable()
+#define PERSIST_EEPROM_BASE 256   // EEPROM address of the store, after the alarms
+#define PERSIST_INTERVAL 5000     // Default write back interval [ms]
+
+#endif
+
+#define MAX_SYNC_VARIABLES 40  // Maximum number of variables registered with syncVariable()
+#define MAX_TIMED_ACTIONS 8  // Maximum number of concurrent pulse/blink/ramp actions
+
 #define VARIABLELEN 14
-#define VALUELEN 14
+#define VALUELEN 14  // Longer values are truncated, see setValueBufferSize() and setLongValueHandler()
+#define RX_WRITES 8  // Reception times kept for the data waiting to be parsed, see $Ping$
+
+typedef enum {
+  VALUE_BEGIN,  // A value too long for the buffer is starting
+  VALUE_DATA,   // Next part of the value
+  VALUE_END,    // The whole value has been delivered
+  VALUE_ABORT   // Connection lost before the end of the value
+} AMValueChunk;
+
+#define TX_BUFFER_SIZE 128  // Largest packet of any transport
+#define RX_BUFFER_SIZE 128  // Received data waiting to be parsed, several BLE writes per connection event
+
+#define TX_QUEUE_LEN 16    // Interactive messages waiting to be sent
+#define TX_ENTRY_SIZE 48   // Longest message kept in the interactive queue
+#define MAX_CONFLATED 16   // Maximum number of variables registered with conflateVariable()
+#define MAX_COALESCED 8    // Maximum number of variables registered with coalesceVariable()
+
+#if defined(SD_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
+#define BULK_FRAME_SIZE 120      // Bytes read from SD for each bulk frame
+#define BULK_FRAMES_PER_LOOP 2   // Bulk frames sent at each loop(), after the interactive queue is empty
+#endif
+
+#ifdef SD_SUPPORT
+#define SD_NAME_LEN 12     // 8.3 file names
+#define SD_LIST_CACHE 32   // Directory entries kept in RAM, multiple of SD_LIST_PAGE
+#define SD_LIST_PAGE 8     // Directory entries sent for each $SDP$ request
+#endif
+
+#ifdef SDLOGGEDATAGRAPH_SUPPORT
+#define SDLOG_PENDING 16                  // Samples logged before the app sets the time, kept in RAM
+#define SDLOG_SPILL_FILE "PRESYNC.LOG"    // Older samples waiting for the time, see sdLogSpill()
+#define SDLOG_VALID_TIME 978307200000ULL  // [ms] 1/1/2001, earlier times come from the clock started at 1/1/2000 by begin()
+#endif
+
+#define CAP_FRAMED_DOWNLOAD 0x01  // Client accepts SD downloads in SD=$B$<n>:<bytes># frames
+#define CAP_COMPRESSION 0x02      // Client accepts SD downloads and logged data compressed in <var>=$Z$<n>:<bytes># frames
+
+#if defined(COMPRESSION_SUPPORT) && (defined(SD_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT))
+#include "AM_Compressor.h"
+#endif
+
+#include "AM_Transport.h"
+
+/*
+    Outgoing variable, with its "name=" prefix computed once
+
+    Messages written with a topic only encode the value, e.g.
+
+      AMTopic temperature("T");
+      ...
+      amController.writeMessage(temperature, t);
+*/
+class AMTopic {
+
+public:
+
+  AMTopic(const char *variable);
+
+  char prefix[VARIABLELEN + 2];  // name=
+  uint8_t length;                // Length of prefix
+  int8_t conflated;              // -1 until the first message, then 1 if registered with conflateVariable()
+  uint8_t conflatedCount;        // Variables registered with conflateVariable() when conflated was resolved
+};
 
 class AMController {
 
 private:
 
-  BLEService mainService = BLEService("19B10000-E8F2-537E-4F6C-D104768A1214");  // create service
-  BLECharacteristic rxCharacteristic = BLECharacteristic("19B10001-E8F2-537E-4F6C-D104768A1214", BLEWrite | BLENotify, 20, (1 == 1));
-  BLECharacteristic txCharacteristic = BLECharacteristic("19B10002-E8F2-537E-4F6C-D104768A1214", BLERead | BLENotify, 20, (1 == 1));
-
-  BLEService batteryService = BLEService("180F");
-  BLEUnsignedCharCharacteristic batteryLevelCharacteristic = BLEUnsignedCharCharacteristic("2A19", BLERead | BLENotify);
+  AMBleTransport _bleTransport;
+  AMTransport *_transport;
+  AMProfile _profile;  // Profile requested to the transport
 
   volatile bool _dataAvailable;
-  char _remainBuffer[64];
+  char _remainBuffer[RX_BUFFER_SIZE];
+  unsigned long _rxMicros;  // micros() when the message being dispatched was received
+
+  // Writes in _remainBuffer: bytes up to end received at micros
+  typedef struct {
+    uint8_t end;
+    unsigned long micros;
+  } rxWrite;
+
+  rxWrite _rxWrites[RX_WRITES];
+  uint8_t _rxWritesCount;
+
+  unsigned long rxMicrosAt(uint8_t i);
+  unsigned long _rxOverruns;
+  uint8_t _rxGap;  // Writes dropped after the data in _remainBuffer, see RX_GAP_* in AM_UnoR4Ble.cpp
+
+  // Parser state, messages can span several dataAvailable()
+  uint8_t _rxState;  // See RX_* in AM_UnoR4Ble.cpp
+  char _rxVariable[VARIABLELEN + 1];
+  uint8_t _rxVariableLength;
+  char _rxShortValue[VALUELEN + 1];
+  char *_rxValue;         // _rxShortValue or the buffer allocated by setValueBufferSize()
+  uint16_t _rxValueSize;  // Longest value kept in _rxValue
+  uint16_t _rxValueLength;
+  void (*_longValueHandler)(const char *variable, AMValueChunk chunk, const char *data, uint16_t length);
+
+  void dispatchMessage(char *variable, char *value);
+  void deliverMessage(char *variable, char *value);
+
+  typedef struct {
+    const char *variable;
+    char value[VALUELEN + 1];
+    bool pending;
+    uint8_t order;  // Reception order of the pending value
+  } coalescedEntry;
+
+  coalescedEntry _coalesced[MAX_COALESCED];
+  uint8_t _coalescedCount;
+  uint8_t _coalescedPending;
+  unsigned long _coalesceWindow;  // [ms], 0 for each batch of received data
+  unsigned long _coalesceStart;
+  unsigned long _rxCoalesced;
+  uint8_t _coalesceOrder;
+
+  bool coalesceMessage(const char *variable, const char *value);
+  void flushCoalesced(bool force = false);
+  void clearCoalesced();
   volatile bool _connectionChanged;
   volatile bool _connected;
   bool _sync;
 
 #ifdef SD_SUPPORT
+  typedef struct {
+    char name[SD_NAME_LEN + 1];
+    uint32_t size;
+  } sdEntry;
+
+  sdEntry _sdList[SD_LIST_CACHE];  // Window of the root directory listing
+  uint16_t _sdListFirst;           // Index of _sdList[0] in the listing
+  uint16_t _sdListCount;           // Entries in _sdList
+  uint16_t _sdListTotal;           // Files in the root directory
+  bool _sdListValid;
+
   void manageSD(char *variable, char *value);
+  bool sdListLoad(uint16_t first, bool send = false);
+  void sdListSend(const sdEntry *entry);
+  const sdEntry *sdListEntry(uint16_t index);
+  void sdListUpdate(const char *name, uint32_t size);
 #endif
 
 #ifdef ALARMS_SUPPORT
@@ -126,12 +324,22 @@ private:
 
   char _alarmId[8];
   unsigned long _alarmTime;
+  unsigned long _alarmArmed;  // Time programmed in the RTC alarm, 0 if none
 
   void manageAlarms(char *variable, char *value);
 #endif
 
 #if defined(ALARMS_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
-  RTClock *_rtc = NULL;
+  RTClock *_rtc = &RTC;
+
+  /*
+      Current time is _clockSeconds + (millis() - _clockMillis), anchored to the RTC at begin() and at each $Time$
+    */
+  unsigned long _clockSeconds;
+  unsigned long _clockMillis;
+  unsigned long _clockLast;  // millis() at the last nowMs(), to detect its wrap around
+
+  void setClock(unsigned long unixTime);
 #endif
 
   /**
@@ -173,6 +381,224 @@ private:
 
   void readVariable(void);
 
+  typedef struct {
+    const char *variable;
+    uint8_t type;  // 0 int, 1 float, 2 text
+    const void *value;
+  } syncEntry;
+
+  syncEntry _syncEntries[MAX_SYNC_VARIABLES];
+  uint8_t _syncEntriesCount;
+  unsigned long _syncDuration;
+
+  bool addSyncVariable(const char *variable, uint8_t type, const void *value);
+  void sendSyncVariables();
+
+  /*
+      Outgoing data is packed in _txBuffer and sent when a full transport packet is available
+    */
+  uint8_t _txBuffer[TX_BUFFER_SIZE];
+  uint8_t _txLength;
+
+  void txAppend(const uint8_t *data, int l);
+  void txAppend(const char *data);
+  void txFlush();
+
+  /*
+      Outgoing traffic has two priority classes:
+      - interactive: messages written by the sketch and replies, kept in _txQueue
+      - bulk: SD downloads and logged data, sent a slice at a time with the capacity left by interactive messages
+    */
+  typedef struct {
+    uint8_t length;
+    uint8_t nameLength;  // Length of "variable=" if the message can be replaced by a newer one, 0 otherwise
+    char data[TX_ENTRY_SIZE];
+  } txEntry;
+
+  txEntry _txQueue[TX_QUEUE_LEN];
+  uint8_t _txHead;
+  uint8_t _txCount;
+  unsigned long _txDropped;
+  unsigned long _txConflated;
+  uint8_t _clientCaps;
+
+  const char *_conflated[MAX_CONFLATED];
+  uint8_t _conflatedCount;
+
+  bool isConflated(const char *message, uint8_t nameLength);
+
+  void sendPong(const char *token, unsigned long dispatchMicros);
+
+  void enqueueMessage(const char *message, uint8_t l);
+  void enqueueEntry(const char *message, uint8_t l, uint8_t nameLength);
+  void enqueueTopic(AMTopic &topic, const char *message, uint8_t l);
+  bool interactiveAllowed();
+  void sendInteractive();
+  void serviceTx();
+
+#if defined(STREAMING_SUPPORT)
+  char _streamVariable[VARIABLELEN + 1];
+  unsigned long _streamPeriod;  // [us]
+  uint32_t _streamNextSeq;      // Sequence number expected for the next frame
+  unsigned long _streamGaps;
+
+  bool streamStart(const char *variable, int8_t pin, float rate);
+  void streamStep();
+#endif
+
+#if defined(TRACE_SUPPORT)
+  Print *_trace;
+  unsigned long _traceLast;
+
+  void traceEvent(char type, const uint8_t *data, uint8_t l);
+#endif
+
+#if defined(MEMORY_STATS_SUPPORT)
+  uint8_t _rxHighWater;
+  uint8_t _queueHighWater;
+  uint8_t _messageHighWater;
+
+  void paintStack();
+  void sendMemoryStats();
+#endif
+
+#if defined(SD_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
+  File _bulkFile;
+  uint8_t _bulkType;  // See BULK_* in AM_UnoR4Ble.cpp
+  char _bulkVariable[VARIABLELEN + 1];
+  unsigned long _bulkStart;
+  unsigned long _bulkBytes;  // Read from SD
+  unsigned long _bulkSent;   // Sent, including frame headers
+  unsigned long _bulkThroughput;
+
+#if defined(COMPRESSION_SUPPORT)
+  AMCompressor _compressor;
+#endif
+
+  void bulkBegin(File &file, uint8_t type, const char *variable);
+  void bulkStep();
+  void bulkEnd(bool notify);
+#endif
+
+#ifdef SDLOGGEDATAGRAPH_SUPPORT
+  void sdLogValues(const char *variable, uint64_t time, uint8_t n, const float *values);
+  void sdLogLine(File &file, uint64_t time, uint8_t n, const float *values);
+
+  typedef struct {
+    char variable[VARIABLELEN + 1];
+    uint8_t n;
+    unsigned long time;  // [ms] from 1/1/2000
+    float values[5];
+  } pendingSample;
+
+  pendingSample _pending[SDLOG_PENDING];
+  uint8_t _pendingHead;
+  uint8_t _pendingCount;
+  unsigned long _pendingSpilled;  // Samples in SDLOG_SPILL_FILE
+  bool _pendingSpill;
+  bool _clockSynced;  // Time set by the app
+  bool _logMilliseconds;
+
+  void sdLogHold(const char *variable, uint64_t time, uint8_t n, const float *values);
+  void sdLogSpillPending();
+  void sdLogRebase(unsigned long unixTime);
+  void sdLogAppend(File &file, char *current, const char *variable, uint64_t time, uint8_t n, const float *values);
+#endif
+
+  typedef struct {
+    uint8_t type;  // 0 free, see ACTION_* in AM_UnoR4Ble.cpp
+    uint8_t pin;
+    uint8_t restore;  // Pin level when the action started (pulse and blink)
+    bool on;
+    uint16_t from;
+    uint16_t to;
+    uint16_t times;  // Remaining blinks, 0 forever
+    unsigned long start;
+    unsigned long onMs;  // Pulse length, blink on time or ramp length
+    unsigned long offMs;
+  } timedAction;
+
+  timedAction _timedActions[MAX_TIMED_ACTIONS];
+
+#if defined(STATISTICS_SUPPORT)
+  typedef struct {
+    uint16_t count;
+    float mean;
+    float m2;  // Sum of squared differences from the mean (Welford)
+    float min;
+    float max;
+  } statsBucket;
+
+  typedef struct {
+    const char *variable;
+    unsigned long bucketLength;  // [ms]
+    unsigned long bucketStart;
+    unsigned long publishInterval;
+    unsigned long lastPublish;
+    bool log;
+    uint8_t current;
+    statsBucket buckets[STATS_BUCKETS];
+  } statsEntry;
+
+  statsEntry _stats[MAX_STATISTICS];
+  uint8_t _statsCount;
+
+  int8_t statsIndex(const char *variable);
+  void statsRotate(statsEntry *e);
+  void statsCompute(statsEntry *e, AMStatistics &s);
+  void serviceStatistics();
+#endif
+
+#if defined(ANALOG_CHANNELS_SUPPORT)
+  typedef struct {
+    uint8_t pin;
+    uint8_t resolution;
+    uint8_t points;   // Calibration points or table entries, 0 if linear
+    uint8_t shift;    // Table: ADC codes between two entries = 2^shift
+    int64_t factor;   // Linear: value of one ADC code [1/ANALOG_SCALE units, Q16]
+    const AMCalibrationPoint *calibration;
+    const int32_t *table;
+    char units[ANALOG_UNITS_LEN + 1];
+    uint16_t raw;
+    int32_t value;
+  } analogChannel;
+
+  analogChannel _analogChannels[MAX_ANALOG_CHANNELS];
+  uint8_t _analogChannelsCount;
+  uint8_t _analogResolution;  // ADC resolution last set by analogScan(), 0 if unknown
+
+  int8_t analogIndex(uint8_t pin);
+  int32_t analogConvert(analogChannel *c);
+#endif
+
+#if defined(PERSISTENCE_SUPPORT)
+  typedef struct {
+    char name[VARIABLELEN + 1];  // Empty if free
+    char value[VALUELEN + 1];
+  } persistRecord;
+
+  persistRecord _persist[MAX_PERSISTENT];  // RAM copy of the EEPROM store
+  uint16_t _persistRegistered;             // Bit i set: _persist[i] registered with persistVariable()
+  uint16_t _persistDirty;                  // Bit i set: _persist[i] has to be written back
+  unsigned long _persistDirtySince;
+  unsigned long _persistInterval;
+  bool _persistLoaded;
+  bool _persistValid;                      // EEPROM holds a whole table, see persistFlush()
+  bool _persistRestored;
+  const char *_persistPending[MAX_PERSISTENT];  // Registered while the store was full, see persistVariable()
+  uint8_t _persistPendingCount;
+
+  void persistLoad();
+  int8_t persistReclaim();
+  void persistAssign(uint8_t slot, const char *variable);
+  void persistStore(const char *variable, const char *value);
+  void persistRestore();
+#endif
+
+  int8_t addTimedAction(uint8_t type, uint8_t pin);
+  void endTimedAction(uint8_t i);
+  void serviceTimedActions();
+
 #ifdef ALARMS_SUPPORT
 
   void syncTime();
@@ -180,6 +606,7 @@ private:
 
   void initializeAlarms();
   static void enableCheckAlarms();
+  void scheduleAlarms();
   void checkAndFireAlarms();
   void createUpdateAlarm(char *id, unsigned long time, bool repeat);
   void removeAlarm(char *id);
@@ -208,17 +635,151 @@ public:
     void (*deviceDisconnected)(void));
 #endif
 
+  /*
+      Replaces the default BLE transport. Has to be called before begin()
+    */
+  void setTransport(AMTransport *transport);
+
   void begin();
 
   void loop();
   void loop(unsigned long delay);
   void writeMessage(const char *variable, int value);
   void writeMessage(const char *variable, float value);
+
+  /*
+      Same as above, without formatting the variable name and without printf
+    */
+  void writeMessage(AMTopic &topic, int value);
+  void writeMessage(AMTopic &topic, float value);
   void writeTripleMessage(const char *variable, float vX, float vY, float vZ);
   void writeTxtMessage(const char *variable, const char *value);
 
+  /*
+      Registers a variable sent to the app when it asks for Sync.
+      All the registered variables are sent back to back, packed in as few packets as possible, before calling doSync
+    */
+  bool syncVariable(const char *variable, const int *value);
+  bool syncVariable(const char *variable, const float *value);
+  bool syncVariable(const char *variable, const char *value);
+
+  /*
+      Interactive messages discarded because the queue was full
+    */
+  unsigned long droppedMessages();
+
+  /*
+      Connection profile. With BLE the connection interval and supervision timeout are requested
+      to the app when it connects: a profile set while connected takes effect at the next connection.
+      profile() is the profile requested, the central may grant different parameters
+    */
+  void setProfile(AMProfile profile);
+  AMProfile profile();
+
+  /*
+      Marks variable as telemetry: while a message for it is still waiting to be sent (slow link
+      or notifications not enabled) a newer value replaces it, instead of being queued behind it
+    */
+  bool conflateVariable(const char *variable);
+
+  /*
+      Messages replaced by a newer value before being sent
+    */
+  unsigned long conflatedMessages();
+
+  /*
+      Marks variable as continuous input (sliders, knobs, joysticks): of the values received in the same batch,
+      or within the window set with setCoalesceWindow(), only the latest one is passed to processIncomingMessages.
+      Other variables (buttons, commands) are still delivered one by one, in order: a value kept is delivered
+      before any message received after it. Values not yet delivered are discarded when the app disconnects
+    */
+  bool coalesceVariable(const char *variable);
+  void setCoalesceWindow(unsigned long window);
+
+  /*
+      Received values replaced by a newer one before being delivered
+    */
+  unsigned long coalescedMessages();
+
+  /*
+      Received bytes discarded because the receive buffer was full. Writes are discarded whole,
+      together with the message they belong to
+    */
+  unsigned long rxOverruns();
+
+  /*
+      Values up to size characters (e.g. JSON configurations, WiFi credentials) are passed whole to processIncomingMessages.
+      The buffer is allocated once, call it from setup(). Longer values are truncated
+    */
+  bool setValueBufferSize(uint16_t size);
+
+  /*
+      Values too long for the buffer are passed to handler in chunks, as they are received,
+      instead of being truncated: VALUE_BEGIN, VALUE_DATA one or more times, VALUE_END.
+      data is not terminated
+    */
+  void setLongValueHandler(void (*handler)(const char *variable, AMValueChunk chunk, const char *data, uint16_t length));
+
+#if defined(PERSISTENCE_SUPPORT)
+  /*
+      Values received for variable are stored in EEPROM and passed again to processIncomingMessages
+      at the first loop() after a reset, so that the sketch restarts with the settings of the app.
+      variable has to stay valid (e.g. a string literal). False if MAX_PERSISTENT variables are already registered:
+      slots of variables stored by a previous sketch are reused only when this one doesn't register them
+    */
+  bool persistVariable(const char *variable);
+
+  /*
+      Values changed are written to EEPROM at most once every interval [ms] (default PERSIST_INTERVAL),
+      so that dragging a slider doesn't wear the EEPROM out
+    */
+  void setPersistInterval(unsigned long interval);
+
+  /*
+      Writes values not yet stored immediately (e.g. before sleeping or switching power off)
+    */
+  void persistFlush();
+#endif
+
+  /*
+      Time [ms] taken by the last Sync
+    */
+  unsigned long syncDuration();
+
+  /*
+      Sends n values in a single message variable=v1:v2:...:vn#
+      Floats are rounded to precision decimals, at most 9
+    */
+  void writeArrayMessage(const char *variable, const float *values, uint8_t n, uint8_t precision = 2);
+  void writeArrayMessage(const char *variable, const int *values, uint8_t n);
+
   void updateBatteryLevel(uint8_t level);
 
+#if defined(SD_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
+  /*
+      Throughput [bytes/s] achieved by the last SD download or logged data transfer
+    */
+  unsigned long bulkThroughput();
+#endif
+
+#if defined(TRACE_SUPPORT)
+  /*
+      Records connections, received data and sent packets on out (Serial, a File on SD, ...)
+      One line for each event: <type><ms since previous event> <data>
+      C connected, D disconnected, R received, T sent. Traces can be replayed with AMReplayTransport
+    */
+  void traceBegin(Print *out);
+  void traceEnd();
+#endif
+
+#if defined(MEMORY_STATS_SUPPORT)
+  /*
+      Stack (painted in begin()), heap and library buffers usage.
+      Also sent to the app as $Mem$=stackUsed:stackSize:heapFree:heapLargest:rx:queue:message# when it sends $Mem$
+    */
+  void memoryStats(AMMemoryStats &stats);
+#endif
+
   void log(const char *msg);
   void log(int msg);
 
@@ -227,13 +788,140 @@ public:
   void logLn(long msg);
   void logLn(unsigned long msg);
 
+  /*
+      Sets pin at value and restores its previous level after ms. Doesn't block
+    */
   void temporaryDigitalWrite(uint8_t pin, uint8_t value, unsigned long ms);
+
+  /*
+      Timed actions executed from loop(). Each function returns the action id or -1 if
+      MAX_TIMED_ACTIONS are already running. A new action on a pin replaces the running one
+    */
+  int8_t pulsePin(uint8_t pin, uint8_t value, unsigned long ms);
+  int8_t blinkPin(uint8_t pin, unsigned long onMs, unsigned long offMs, uint16_t times = 0);
+  int8_t rampPin(uint8_t pin, uint16_t from, uint16_t to, unsigned long ms);
+  void cancelPinAction(int8_t id);
+  void cancelPinActions(uint8_t pin);
   float to_voltage(float adc_value, float vref, uint8_t resolution = 10);
+
+  /*
+      Average of samples conversions. Safe while the sampler or the stream is running.
+      For a pin sampled in background, average of its last samples raw samples (at most SAMPLER_RING), taken by the sampler
+    */
   uint16_t avgAnalogRead(uint8_t pin, uint8_t samples);
+
+#if defined(SAMPLER_SUPPORT)
+  /*
+      Adds an analog input to the background sampler. Channels have to be added before samplerBegin()
+      param is the window for FILTER_MOVING_AVERAGE and FILTER_MEDIAN (max SAMPLER_RING) and the shift for FILTER_EXPONENTIAL
+    */
+  bool samplerAddChannel(uint8_t pin, AMFilter filter = FILTER_NONE, uint8_t param = 0);
+
+  /*
+      Starts sampling all the channels at rate [Hz] from a hardware timer.
+      While it runs the timer interrupt uses the ADC: the sketch must not call analogRead() or analogReadResolution(),
+      but sampledValue(), avgAnalogRead() or analogScan()
+    */
+  bool samplerBegin(float rate);
+  void samplerStop();
+
+  /*
+      Latest filtered value of pin (O(1), never blocks)
+    */
+  uint16_t sampledValue(uint8_t pin);
+#endif
+
+#if defined(ANALOG_CHANNELS_SUPPORT)
+  /*
+      Adds an analog input to the channel table. Without calibration the value is linear,
+      0 at ADC code 0 and fullScale [units] at the highest code (e.g. VCC for a voltage).
+      The RA4M1 ADC has a single resolution: analogScan() switches it for channels with a different one,
+      don't mix resolutions while the background sampler is running
+    */
+  bool analogAddChannel(uint8_t pin, float fullScale, const char *units = "", uint8_t resolution = 10);
+
+  /*
+      Piecewise linear calibration through n >= 2 points sorted by raw, extrapolated beyond the first and the last.
+      points is not copied and has to stay valid (e.g. a const global)
+    */
+  bool analogCalibrate(uint8_t pin, const AMCalibrationPoint *points, uint8_t n);
+
+  /*
+      Lookup table calibration (e.g. thermistors): n = 2^k + 1 values [1/ANALOG_SCALE units] equally spaced
+      from ADC code 0 to the full range, interpolated without divisions. table is not copied
+    */
+  bool analogLookupTable(uint8_t pin, const int32_t *table, uint8_t n);
+
+  /*
+      Reads and converts all the channels in one pass, with integer math.
+      Pins sampled in background use their filtered value
+    */
+  void analogScan();
+
+  /*
+      Values converted by the last analogScan(), 0 if pin is not in the table
+    */
+  float analogValue(uint8_t pin);
+  int32_t analogMilliValue(uint8_t pin);  // [1/ANALOG_SCALE units]
+  uint16_t analogRaw(uint8_t pin);
+  const char *analogUnits(uint8_t pin);
+#endif
+
+#if defined(STREAMING_SUPPORT)
+  /*
+      Streams pin sampled at rate [Hz] from a hardware timer, in frames of several samples
+
+        variable=$ST$<t>:<period>:<seq>:<samples>#
+
+      t [ms from streamBegin] and seq refer to the first sample of the frame, period is in [us].
+      Each sample (0 - 4095) takes 2 characters of the base64 alphabet, most significant first.
+      Frames fill whole transport packets, t may have a leading zero to that end. As for the sampler, the sketch must not call analogRead() while streaming a pin
+    */
+  bool streamBegin(const char *variable, uint8_t pin, float rate);
+
+  /*
+      Same, with samples (0 - 4095) provided by the sketch with streamPush() at rate [Hz] (e.g. an IMU)
+    */
+  bool streamBegin(const char *variable, float rate);
+  void streamPush(uint16_t value);
+  void streamStop();
+
+  /*
+      Samples discarded because the link was slower than sampling
+    */
+  unsigned long streamOverruns();
+
+  /*
+      Frames not contiguous to the previous one, because of overruns
+    */
+  unsigned long streamGaps();
+#endif
+
+#if defined(STATISTICS_SUPPORT)
+  /*
+      Keeps mean, min, max and standard deviation of the values passed to statisticsUpdate() over the last window [ms].
+      Every publish [ms] (0 never) they are sent as variable=mean:min:max:stddev# and, if log is true, logged on SD
+    */
+  bool statisticsAdd(const char *variable, unsigned long window, unsigned long publish = 0, bool log = false);
+
+  /*
+      O(1), can be called for every sample
+    */
+  void statisticsUpdate(const char *variable, float value);
+
+  /*
+      Statistics over the current window. False if variable is not registered
+    */
+  bool statistics(const char *variable, AMStatistics &statistics);
+#endif
   
 
 #if defined(ALARMS_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)
+  /*
+      Unix time [s] and [ms], computed from millis() without reading the RTC
+    */
   unsigned long now();
+  uint64_t nowMs();
 #endif
 
 #if (defined(ALARMS_SUPPORT) || defined(SDLOGGEDATAGRAPH_SUPPORT)) && defined(DEBUG)
@@ -244,6 +932,14 @@ public:
   void dumpAlarms();
 #endif
 
+#ifdef SD_SUPPORT
+  /*
+      The SD listing sent to the app is cached and kept up to date by sdLog and sdPurgeLogData.
+      Call this after creating, writing or deleting files on SD directly
+    */
+  void sdInvalidateList();
+#endif
+
 #ifdef SDLOGGEDATAGRAPH_SUPPORT
 
   void sdLogLabels(const char *variable, const char *label1);
@@ -258,6 +954,34 @@ public:
   void sdLog(const char *variable, unsigned long time, float v1, float v2, float v3, float v4);
   void sdLog(const char *variable, unsigned long time, float v1, float v2, float v3, float v4, float v5);
 
+  /*
+      Same as sdLog with time in [ms] (e.g. nowMs()), for samples faster than 1 Hz.
+      The fraction of second is written only after sdLogMilliseconds(true)
+    */
+  void sdLogMs(const char *variable, uint64_t time, float v1);
+  void sdLogMs(const char *variable, uint64_t time, float v1, float v2);
+  void sdLogMs(const char *variable, uint64_t time, float v1, float v2, float v3);
+  void sdLogMs(const char *variable, uint64_t time, float v1, float v2, float v3, float v4);
+  void sdLogMs(const char *variable, uint64_t time, float v1, float v2, float v3, float v4, float v5);
+
+  /*
+      Samples logged before the app sets the time are kept, SDLOG_PENDING of them in RAM, and written
+      with the right time as soon as it arrives. With spill true, samples not fitting in RAM are moved to
+      SDLOG_SPILL_FILE instead of discarding the oldest ones
+    */
+  void sdLogSpill(bool spill);
+
+  /*
+      Samples waiting for the time to be set
+    */
+  unsigned long sdLogPending();
+
+  /*
+      Log times are written in integer seconds, as read by the Logged Data widget.
+      With enable true, times with a fraction of second are written as seconds.mmm: only for apps reading them
+    */
+  void sdLogMilliseconds(bool enable);
+
   void sdSendLogData(const char *variable);
 
   uint16_t sdFileSize(const char *variable);
@@ -270,6 +994,8 @@ public:
   void connected(void);
   void disconnected(void);
   void dataAvailable(String string);
+  void dataAvailable(const char *data, uint8_t l);
+  size_t rxSpace();
 };
 
 #endif
@@ -0,0 +1,89 @@
+/*
+   AMController libraries, example sketches (“The Software”) and the related documentation (“The Documentation”) are supplied to you
+   by the Author in consideration of your agreement to the following terms, and your use or installation of The Software and the use of The Documentation
+   constitutes acceptance of these terms.
+   If you do not agree with these terms, please do not use or install The Software.
+   The Author grants you a personal, non-exclusive license, under author's copyrights in this original software, to use The Software.
+   Except as expressly stated in this notice, no other rights or licenses, express or implied, are granted by the Author, including but not limited to any
+   patent rights that may be infringed by your derivative works or by other works in which The Software may be incorporated.
+   The Software and the Documentation are provided by the Author on an "AS IS" basis.  THE AUTHOR MAKES NO WARRANTIES, EXPRESS OR IMPLIED, INCLUDING WITHOUT
+   LIMITATION THE IMPLIED WARRANTIES OF NON-INFRINGEMENT, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE, REGARDING THE SOFTWARE OR ITS USE AND OPERATION
+   ALONE OR IN COMBINATION WITH YOUR PRODUCTS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES (INCLUDING,
+   BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF THE USE,
+   REPRODUCTION AND MODIFICATION OF THE SOFTWARE AND OR OF THE DOCUMENTATION, HOWEVER CAUSED AND WHETHER UNDER THEORY OF CONTRACT, TORT (INCLUDING NEGLIGENCE),
+   STRICT LIABILITY OR OTHERWISE, EVEN IF THE AUTHOR HAS BEEN ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+   Author: Fabrizio Boco - fabboco@gmail.com
+
+   Version: 1.0.0
+
+   All rights reserved
+
+*/
+#ifndef AM_UnoR4Ble_Config_H
+#define AM_UnoR4Ble_Config_H
+
+/*
+    Features compiled in the library
+
+    Unused features can be removed without editing this file by adding the corresponding AM_NO_xxx define
+    to the build flags (default on features) or AM_WITH_xxx (default off features), e.g.:
+
+      arduino-cli compile --build-property "compiler.cpp.extra_flags=-DAM_NO_ALARMS -DAM_NO_SD" ...
+
+    Disabled features are compiled out completely (code, buffers and libraries)
+    See extras/footprint.sh for the flash and RAM used by each combination
+*/
+
+#if !defined(AM_NO_ALARMS)
+#define ALARMS_SUPPORT  // support for Alarm Widget
+#endif
+
+#if !defined(AM_NO_SD)
+#define SD_SUPPORT  // support for SD Widget
+#endif
+
+#if !defined(AM_NO_SDLOGGEDATAGRAPH)
+#define SDLOGGEDATAGRAPH_SUPPORT  // support for Logged Data Widget
+#endif
+
+#if !defined(AM_NO_SAMPLER)
+#define SAMPLER_SUPPORT  // background analog sampler
+#endif
+
+#if !defined(AM_NO_ANALOG_CHANNELS)
+#define ANALOG_CHANNELS_SUPPORT  // analog channel table with calibration and engineering units
+#endif
+
+#if !defined(AM_NO_STREAMING)
+#define STREAMING_SUPPORT  // high rate sample streaming in batched frames
+#endif
+
+#if !defined(AM_NO_STATISTICS)
+#define STATISTICS_SUPPORT  // rolling mean/min/max/stddev of variables
+#endif
+
+#if !defined(AM_NO_PERSISTENCE)
+#define PERSISTENCE_SUPPORT  // widget state kept in EEPROM across resets (persistVariable)
+#endif
+
+#if !defined(AM_NO_COMPRESSION)
+#define COMPRESSION_SUPPORT  // compressed SD downloads and logged data, for clients which support it
+#endif
+
+#if defined(AM_WITH_TCP_TRANSPORT)
+#define TCP_TRANSPORT_SUPPORT  // TCP transport over WiFi (AMTcpTransport)
+#endif
+
+#if defined(AM_WITH_TRACE)
+#define TRACE_SUPPORT  // session trace recorder and AMReplayTransport
+#endif
+
+#if defined(AM_WITH_MEMORY_STATS)
+#define MEMORY_STATS_SUPPORT  // stack painting, heap and buffer high-water marks (memoryStats, $Mem$)
+#endif
+
+// #define DEBUG                     // uncomment to enable debugging - You should not need it !
+// #define DEBUG_ALARMS              // uncomment to enable alarms debugging (DEBUG has to be uncommented as well)
+
+#endif